@@ -0,0 +1,154 @@
+/*
+ benchmark helpers: timing, percentiles and JSON reporting
+*/
+var now = ( process.hrtime ) ?
+    function(){
+        var t = process.hrtime();
+        return t[0] * 1e3 + t[1] / 1e6;
+    } :
+    function(){
+        return Date.now();
+    };
+
+function percentile( sorted, p )
+{
+    if( !sorted.length ){
+        return 0;
+    }
+    return sorted[Math.min( sorted.length - 1, Math.floor( sorted.length * p ) )];
+}
+
+function report( name, params, lat, elapsed, mem )
+{
+    var result = {
+            bench: name,
+            ops: lat.length,
+            ms: +elapsed.toFixed( 3 ),
+            opsPerSec: Math.round( lat.length * 1000 / elapsed ),
+            p50: +percentile( lat, 0.5 ).toFixed( 4 ),
+            p99: +percentile( lat, 0.99 ).toFixed( 4 ),
+            heapBytesPerOp: Math.round( mem.heap / lat.length ),
+            rssBytes: mem.rss
+        },
+        key;
+    
+    for( key in params ){
+        result[key] = params[key];
+    }
+    return result;
+}
+
+function memStart()
+{
+    if( typeof gc === 'function' ){
+        gc();
+    }
+    return process.memoryUsage();
+}
+
+function memDelta( start )
+{
+    var end = process.memoryUsage();
+    return { heap: end.heapUsed - start.heapUsed, rss: end.rss - start.rss };
+}
+
+// run fn() repeatedly for opts.seconds; latency in ms per call
+exports.sync = function( name, params, opts, fn )
+{
+    var lat = [],
+        limit = opts.seconds * 1000,
+        mem = memStart(),
+        start = now(),
+        t = 0;
+    
+    do {
+        t = now();
+        fn();
+        lat.push( now() - t );
+    } while( now() - start < limit );
+    
+    return report( name, params, lat.sort( function( a, b ){ return a - b; } ),
+                   now() - start, memDelta( mem ) );
+};
+
+// run fn( done ) with opts.concurrency calls in flight for opts.seconds
+exports.async = function( name, params, opts, fn, callback )
+{
+    var lat = [],
+        limit = opts.seconds * 1000,
+        mem = memStart(),
+        start = now(),
+        running = 0,
+        finished = false;
+    
+    function next()
+    {
+        var t = now();
+        
+        running++;
+        fn( function( err )
+        {
+            running--;
+            if( err ){
+                throw err;
+            }
+            lat.push( now() - t );
+            if( now() - start < limit ){
+                next();
+            }
+            else if( !running && !finished ){
+                finished = true;
+                callback( report( name, params, lat.sort( function( a, b ){ return a - b; } ),
+                                  now() - start, memDelta( mem ) ) );
+            }
+        });
+    }
+    
+    for( var i = 0; i < opts.concurrency; i++ ){
+        next();
+    }
+};
+
+// command line: [seconds] [--out file]
+exports.options = function()
+{
+    var argv = process.argv.slice( 2 ),
+        opts = { seconds: 2, concurrency: 16, out: null },
+        i;
+    
+    for( i = 0; i < argv.length; i++ )
+    {
+        if( argv[i] === '--out' ){
+            opts.out = argv[++i];
+        }
+        else if( argv[i] === '--concurrency' ){
+            opts.concurrency = +argv[++i];
+        }
+        else if( +argv[i] > 0 ){
+            opts.seconds = +argv[i];
+        }
+    }
+    return opts;
+};
+
+// print results as JSON lines, or write them to --out
+exports.print = function( results )
+{
+    var opts = exports.options();
+    
+    if( opts.out )
+    {
+        require('fs').writeFileSync( opts.out, JSON.stringify({
+            node: process.version,
+            arch: process.arch,
+            date: new Date().toISOString(),
+            seconds: opts.seconds,
+            results: results
+        }, null, 2 ) );
+    }
+    else {
+        results.forEach( function( result ){
+            console.log( JSON.stringify( result ) );
+        });
+    }
+};
@@ -0,0 +1,27 @@
+/*
+ benchmark suite: parse, marshal and render hot paths
+ usage: node [--expose-gc] bench/index.js [seconds] [--concurrency n] [--out file]
+ 
+ every result is one JSON object; with --out the whole run is written
+ as { node, arch, date, results:[...] } for comparing builds.
+*/
+var common = require( __dirname + '/common' ),
+    SUITES = [ 'parse', 'setValue', 'render' ],
+    opts = common.options(),
+    results = [];
+
+function next()
+{
+    var name = SUITES.shift();
+    
+    if( !name ){
+        return common.print( results );
+    }
+    require( __dirname + '/' + name ).run( opts, function( list )
+    {
+        results = results.concat( list );
+        next();
+    });
+}
+
+next();
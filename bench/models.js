@@ -0,0 +1,38 @@
+/*
+ view models of several sizes; about 8 leaves per row
+*/
+var SIZES = {
+    small: 500,
+    medium: 5000,
+    large: 50000
+};
+
+function model( nleaf )
+{
+    var rows = [],
+        i;
+    
+    for( i = 0; i * 8 < nleaf; i++ )
+    {
+        rows.push({
+            id: i,
+            name: 'item <' + i + '> & "friends"',
+            url: 'http://example.com/item?id=' + i + '&q=a b',
+            price: i * 1.25,
+            stock: ( i % 3 === 0 ),
+            updated: new Date( 1325376000000 + i * 1000 ),
+            tags: [ 'a' + i, 'b' + i ],
+            owner: { name: 'owner ' + i }
+        });
+    }
+    return {
+        page: {
+            title: 'bench <page>',
+            script: 'var a = "</script>";',
+            rows: rows
+        }
+    };
+}
+
+exports.SIZES = SIZES;
+exports.model = model;
@@ -0,0 +1,46 @@
+/*
+ benchmark: parseString() of a template with five levels of includes
+ usage: node bench/parse.js [seconds] [--out file]
+*/
+var ClearSilver = require( __dirname + '/../index' ),
+    fs = require('fs'),
+    common = require( __dirname + '/common' ),
+    TEMPLATES = __dirname + '/templates';
+
+exports.run = function( opts, callback )
+{
+    var cs = new ClearSilver(),
+        src = fs.readFileSync( TEMPLATES + '/layout.cs', 'utf8' ),
+        results = [];
+    
+    results.push( common.sync( 'parseString', { template: 'layout.cs' }, opts, function()
+    {
+        var id = cs.createParser();
+        
+        cs.setValue( id, 'Config.loadpaths.0', TEMPLATES );
+        cs.parseString( src, id );
+        cs.removeParser( id );
+    }) );
+    
+    // async compile
+    common.async( 'parseStringAsync', { template: 'layout.cs', concurrency: opts.concurrency }, opts, function( done )
+    {
+        var id = cs.createParser();
+        
+        cs.setValue( id, 'Config.loadpaths.0', TEMPLATES );
+        cs.parseString( src, id, function( err )
+        {
+            cs.removeParser( id );
+            done( err );
+        });
+    },
+    function( result )
+    {
+        results.push( result );
+        callback( results );
+    });
+};
+
+if( require.main === module ){
+    exports.run( common.options(), common.print );
+}
@@ -0,0 +1,53 @@
+/*
+ benchmark: sync and async render() of a template with includes, loops
+ and escaping over view models of several sizes
+ usage: node bench/render.js [seconds] [--concurrency n] [--out file]
+*/
+var ClearSilver = require( __dirname + '/../index' ),
+    fs = require('fs'),
+    common = require( __dirname + '/common' ),
+    models = require( __dirname + '/models' ),
+    TEMPLATES = __dirname + '/templates';
+
+exports.run = function( opts, callback )
+{
+    var cs = new ClearSilver(),
+        src = fs.readFileSync( TEMPLATES + '/layout.cs', 'utf8' ),
+        sizes = Object.keys( models.SIZES ),
+        results = [];
+    
+    function next()
+    {
+        var size = sizes.shift(),
+            nleaf = models.SIZES[size],
+            id = null;
+        
+        if( !size ){
+            return callback( results );
+        }
+        
+        id = cs.createParser();
+        cs.setValue( id, 'Config.loadpaths.0', TEMPLATES );
+        cs.parseString( src, id );
+        cs.setValue( id, null, models.model( nleaf ) );
+        
+        results.push( common.sync( 'render', { model: size, leaves: nleaf }, opts, function(){
+            cs.render( id );
+        }) );
+        // empty overlay: renders share the parser HDF and run in parallel
+        common.async( 'renderAsync', { model: size, leaves: nleaf, concurrency: opts.concurrency }, opts, function( done ){
+            cs.render( id, {}, done );
+        },
+        function( result )
+        {
+            results.push( result );
+            cs.removeParser( id );
+            next();
+        });
+    }
+    next();
+};
+
+if( require.main === module ){
+    exports.run( common.options(), common.print );
+}
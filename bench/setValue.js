@@ -0,0 +1,36 @@
+/*
+ benchmark: setValue() conversion of view models into parser HDF
+ usage: node bench/setValue.js [seconds] [--out file]
+*/
+var ClearSilver = require( __dirname + '/../index' ),
+    common = require( __dirname + '/common' ),
+    models = require( __dirname + '/models' );
+
+exports.run = function( opts, callback )
+{
+    var cs = new ClearSilver(),
+        results = [],
+        size;
+    
+    for( size in models.SIZES )
+    {
+        (function( nleaf )
+        {
+            var data = models.model( nleaf ),
+                id = cs.createParser();
+            
+            results.push( common.sync( 'setValue', { model: size, leaves: nleaf }, opts, function(){
+                cs.setValue( id, null, data );
+            }) );
+            results.push( common.sync( 'setValueDiff', { model: size, leaves: nleaf }, opts, function(){
+                cs.setValue( id, null, data, { diff: true } );
+            }) );
+            cs.removeParser( id );
+        })( models.SIZES[size] );
+    }
+    callback( results );
+};
+
+if( require.main === module ){
+    exports.run( common.options(), common.print );
+}
@@ -0,0 +1 @@
+<div class="footer"><?cs var:html_strip(page.title) ?> - <?cs var:text_html(page.script) ?></div>
@@ -0,0 +1,3 @@
+<div class="header">
+<?cs include:"nav.cs" ?>
+</div>
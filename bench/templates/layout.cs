@@ -0,0 +1,8 @@
+<html>
+<head><title><?cs var:html_escape(page.title) ?></title></head>
+<body>
+<?cs include:"header.cs" ?>
+<?cs include:"list.cs" ?>
+<?cs include:"footer.cs" ?>
+</body>
+</html>
@@ -0,0 +1,13 @@
+<table>
+<?cs each:row = page.rows ?>
+<tr class="<?cs if:row.stock ?>stock<?cs else ?>none<?cs /if ?>">
+<td><?cs var:row.id ?></td>
+<td><?cs var:html_escape(row.name) ?></td>
+<td><a href="<?cs var:url_escape(row.url) ?>"><?cs var:html_escape(row.owner.name) ?></a></td>
+<td><?cs var:row.price ?></td>
+<td><?cs var:row.updated ?></td>
+<td><?cs each:tag = row.tags ?><?cs var:html_escape(tag) ?> <?cs /each ?></td>
+<td><script>var n = "<?cs var:js_escape(row.name) ?>";</script></td>
+</tr>
+<?cs /each ?>
+</table>
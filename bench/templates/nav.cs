@@ -0,0 +1,3 @@
+<ul class="nav">
+<?cs include:"nav_item.cs" ?>
+</ul>
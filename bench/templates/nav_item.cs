@@ -0,0 +1,2 @@
+<li><a href="/"><?cs var:html_escape(page.title) ?></a></li>
+<?cs include:"nav_sub.cs" ?>
@@ -0,0 +1 @@
+<li class="sub"><?cs var:js_escape(page.script) ?></li>
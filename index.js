@@ -4,5 +4,9 @@
  email: mah0x211@gmail.com
  copyright (C) 2012, masatoshi teruya. all rights reserved.
 */
+var binding = require( __dirname + '/build/default/ClearSilver');
 
-module.exports = require( __dirname + '/build/default/ClearSilver').ClearSilver;
+// let renderStream() output be piped into writable streams
+binding.RenderStream.prototype.pipe = require('stream').Stream.prototype.pipe;
+
+module.exports = binding.ClearSilver;
@@ -1,11 +1,18 @@
 #include <node.h>
 #include <node_events.h>
+#include <node_buffer.h>
 
 #include <errno.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <limits.h>
+#include <dirent.h>
+#include <fnmatch.h>
 
 #include <cstring>
 #include <typeinfo>
@@ -79,11 +86,624 @@ static const JS_TYPE TYPE_NAMES[] = {
 #define isRemoval    (JS_TYPE_NULL_BIT|JS_TYPE_UNDEFINED_BIT)
 
 typedef struct ParseCtx_t ParseCtx_t;
+typedef struct Replica_t Replica_t;
+class HDFNode;
 
+// read-only HDF, the global one shared by all parsers or the frozen copy
+// of a parser HDF; refs are held by renders
 typedef struct {
-    void *id;
+    HDF *hdf;
+    uint32_t refs;
+    // unique per setGlobal, or the parser version it was copied at
+    uint32_t version;
+    // serialized hdf of a frozen copy for output cache keys; built once
+    // by the first cached render on it
+    char *canon;
+    size_t canonLen;
+} Global_t;
+
+static uint32_t GlobalVersion = 0;
+
+// take a reference to the current global HDF; NULL if none is set
+static inline Global_t *AcquireGlobal( pthread_mutex_t *mutex, Global_t **current )
+{
+    Global_t *global = NULL;
+    
+    if( *current && 0 == pthread_mutex_lock( mutex ) )
+    {
+        if( ( global = *current ) ){
+            __sync_add_and_fetch( &global->refs, 1 );
+        }
+        pthread_mutex_unlock( mutex );
+    }
+    return global;
+}
+
+// drop a reference; the last one destroys a replaced global HDF
+static inline void ReleaseGlobal( Global_t *global )
+{
+    if( global && 0 == __sync_sub_and_fetch( &global->refs, 1 ) ){
+        hdf_destroy( &global->hdf );
+        free( global->canon );
+        free( global );
+    }
+}
+
+// compiled template of a parser; refs are held by renders, so a replaced
+// tree lives until the last render on it is done
+typedef struct {
+    CSPARSE *csp;
+    uint32_t refs;
+    // compile order within the parser; identifies the template version
+    uint32_t seq;
+} Tree_t;
+
+// take a reference to the current tree; NULL if none is installed
+static inline Tree_t *AcquireTree( pthread_mutex_t *mutex, Tree_t **current )
+{
+    Tree_t *tree = NULL;
+    
+    if( *current && 0 == pthread_mutex_lock( mutex ) )
+    {
+        if( ( tree = *current ) ){
+            __sync_add_and_fetch( &tree->refs, 1 );
+        }
+        pthread_mutex_unlock( mutex );
+    }
+    return tree;
+}
+
+static inline void ReleaseTree( Tree_t *tree )
+{
+    if( tree && 0 == __sync_sub_and_fetch( &tree->refs, 1 ) ){
+        cs_destroy( &tree->csp );
+        free( tree );
+    }
+}
+
+// scratch buffer reused across one JS to HDF conversion
+typedef struct {
+    char *buf;
+    size_t max;
+    // a node was removed; node handles have to be resolved again
+    bool removed;
+} ConvBuf_t;
+
+// objects on the path from the root to the current one, with a count
+// per identity hash bucket; an object is circular only if it is its
+// own ancestor, shared subobjects are converted each time
+#define ANCESTOR_BUCKETS    256
+typedef struct {
+    Local<Object> *objs;
+    int *hashes;
+    uint32_t depth;
+    uint32_t max;
+    uint32_t buckets[ANCESTOR_BUCKETS];
+} Ancestors_t;
+
+// fingerprints of the objects of one view model in pre-order; size is
+// the number of entries of the subtree, so a subtree is skipped by it
+typedef struct {
+    uint64_t hash;
+    uint32_t size;
+} Print_t;
+
+typedef struct {
+    Print_t *list;
+    uint32_t num;
+    uint32_t max;
+} Prints_t;
+
+// default byte budget of include file cache
+#define FILECACHE_MAX_BYTES     (32*1024*1024)
+// default seconds between mtime checks of a cached file
+#define FILECACHE_CHECK_SEC     1
+
+// include file cache entry, linked in least-recently-used order. refs
+// are held by the cache while linked and by includes reading the entry
+// without the cache lock, so an evicted entry lives until they are done.
+typedef struct FileCache_t FileCache_t;
+struct FileCache_t {
+    // realpath
+    char *id;
+    uint32_t refs;
+    char *data;
+    size_t len;
+    // parsed .hdf file
+    HDF *tree;
+    // .hdf file that has to be re-parsed on every include
+    bool raw;
+    // bytes accounted to the cache budget
+    size_t bytes;
+    time_t mtime;
+    off_t size;
+    // last time mtime was checked
+    time_t checked;
+    FileCache_t *prev;
+    FileCache_t *next;
+};
+
+static inline void ReleaseFile( FileCache_t *entry )
+{
+    if( entry && 0 == __sync_sub_and_fetch( &entry->refs, 1 ) ){
+        if( entry->tree ){
+            hdf_destroy( &entry->tree );
+        }
+        free( entry->data );
+        free( entry->id );
+        free( entry );
+    }
+}
+
+// resolved path cache entry
+typedef struct {
+    // "<len>:<loadpath>...;<requested path>", see LoadpathsKey
+    char *id;
+    // realpath or NULL if not found in loadpaths
+    char *path;
+    time_t checked;
+} PathCache_t;
+
+// default byte budget of rendered output cache
+#define OUTCACHE_MAX_BYTES      (16*1024*1024)
+// stale entries at the lru tail dropped per store
+#define OUTCACHE_REAP_MAX       16
+
+// rendered output cache entry, linked in least-recently-used order. an
+// entry is found by a key of the same type with the first six fields set.
+// fragments have serial 0, the fragment serial as version and the include
+// file mtime as global. refs are held by the cache and by renders handing
+// a hit out, so an evicted entry lives until its last reader is done.
+typedef struct OutCache_t OutCache_t;
+struct OutCache_t {
+    // parser, template version, global HDF version and data fingerprint
+    uint32_t serial;
+    uint32_t version;
+    uint32_t global;
+    uint64_t hash;
+    // serialized data the fingerprint was taken of; compared in full, so
+    // colliding fingerprints never share an entry
+    char *canon;
+    size_t canonLen;
+    char *data;
+    size_t len;
+    // NowUsec() after which the entry is stale, 0 is never
+    uint64_t expires;
+    uint32_t refs;
+    OutCache_t *prev;
+    OutCache_t *next;
+};
+
+static UINT32 OutCacheHash( const void *key )
+{
+    const OutCache_t *entry = (const OutCache_t*)key;
+    return (UINT32)( entry->hash ^ ( entry->hash >> 32 ) ) ^ entry->serial;
+}
+
+// ne_hash compare: nonzero if equal
+static int OutCacheComp( const void *a, const void *b )
+{
+    const OutCache_t *x = (const OutCache_t*)a;
+    const OutCache_t *y = (const OutCache_t*)b;
+    
+    return x->hash == y->hash && x->serial == y->serial &&
+           x->version == y->version && x->global == y->global &&
+           x->canonLen == y->canonLen && !memcmp( x->canon, y->canon, x->canonLen );
+}
+
+static inline void ReleaseOut( OutCache_t *entry )
+{
+    if( entry && 0 == __sync_sub_and_fetch( &entry->refs, 1 ) ){
+        free( entry->canon );
+        free( entry->data );
+        free( entry );
+    }
+}
+
+// include file whose rendered output is cached, keyed by the values of
+// the HDF paths in keys
+typedef struct {
+    // realpath
+    char *id;
+    char **keys;
+    uint32_t nkeys;
+    // usec, 0 until evicted
+    uint64_t ttl;
+    // unique per cacheFragment call, so a new declaration drops old output
+    uint32_t serial;
+    // files included by the last render of it, as dependency records
+    char *deps;
+    size_t depsLen;
+} Fragment_t;
+
+static uint32_t FragmentSerial = 0;
+
+// files a fragment render includes, nested fragments included: records of
+// realpath with its NUL, mtime and size, each path once. a lost record
+// leaves the output uncached.
+typedef struct {
+    STRING deps;
+    bool failed;
+} FragmentDeps_t;
+
+// fragment render in progress on this thread, for hookFileload
+static __thread FragmentDeps_t *FragmentDeps = NULL;
+
+// next dependency record at *pos of deps; false past the end
+static inline bool NextDep( const char *deps, size_t len, size_t *pos, const char **path, time_t *mtime, off_t *size )
+{
+    size_t plen = 0;
+    
+    if( *pos >= len ){
+        return false;
+    }
+    *path = deps + *pos;
+    plen = strlen( *path ) + 1;
+    memcpy( mtime, deps + *pos + plen, sizeof( time_t ) );
+    memcpy( size, deps + *pos + plen + sizeof( time_t ), sizeof( off_t ) );
+    *pos += plen + sizeof( time_t ) + sizeof( off_t );
+    return true;
+}
+
+static void AddDep( FragmentDeps_t *deps, const char *path, time_t mtime, off_t size )
+{
+    NEOERR *nerr = STATUS_OK;
+    const char *seen = NULL;
+    time_t seenTime = 0;
+    off_t seenSize = 0;
+    size_t pos = 0;
+    
+    while( !deps->failed && NextDep( deps->deps.buf, deps->deps.len, &pos, &seen, &seenTime, &seenSize ) )
+    {
+        if( !strcmp( seen, path ) ){
+            return;
+        }
+    }
+    if( !deps->failed &&
+        ( STATUS_OK != ( nerr = string_appendn( &deps->deps, path, strlen( path ) + 1 ) ) ||
+          STATUS_OK != ( nerr = string_appendn( &deps->deps, (const char*)&mtime, sizeof( time_t ) ) ) ||
+          STATUS_OK != ( nerr = string_appendn( &deps->deps, (const char*)&size, sizeof( off_t ) ) ) ) ){
+        nerr_ignore( &nerr );
+        deps->failed = true;
+    }
+}
+
+static inline void MergeDeps( FragmentDeps_t *deps, const char *from, size_t len )
+{
+    const char *path = NULL;
+    time_t mtime = 0;
+    off_t size = 0;
+    size_t pos = 0;
+    
+    while( NextDep( from, len, &pos, &path, &mtime, &size ) ){
+        AddDep( deps, path, mtime, size );
+    }
+}
+
+static inline void DestroyFragment( Fragment_t *frag )
+{
+    uint32_t i = 0;
+    
+    for( i = 0; i < frag->nkeys; i++ ){
+        free( frag->keys[i] );
+    }
+    free( frag->keys );
+    free( frag->deps );
+    free( frag->id );
+    free( frag );
+}
+
+static inline uint32_t NumCPU( void )
+{
+    long ncpu = sysconf( _SC_NPROCESSORS_ONLN );
+    return ( ncpu > 0 ) ? (uint32_t)ncpu : 1;
+}
+
+static inline uint64_t NowUsec( void )
+{
+    struct timespec ts;
+    
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline void StatMax( uint64_t *max, uint64_t val )
+{
+    uint64_t cur = *max;
+    
+    while( val > cur && !__sync_bool_compare_and_swap( max, cur, val ) ){
+        cur = *max;
+    }
+}
+
+// NUL terminated copy of len bytes
+static inline char *DupBytes( const char *data, size_t len )
+{
+    char *str = (char*)malloc( len + 1 );
+    
+    if( str ){
+        memcpy( str, data, len );
+        str[len] = 0;
+    }
+    return str;
+}
+
+// MARK: render pool
+// renders run on workers owned by the addon instead of the libeio pool
+// shared with fs, so render bursts and disk traffic do not starve each
+// other. each worker has its own queue and steals from the others when
+// it runs dry; finished jobs go back to the loop in batches.
+#define RENDER_POOL_MAX     256
+// job priorities 0 (low) to RENDER_PRIORITIES - 1; render defaults to 1
+#define RENDER_PRIORITIES   3
+#define RENDER_PRIORITY     1
+
+typedef void (*JobFunc)( void *data );
+
+// embedded in the request it runs; nothing is allocated per job
+typedef struct Job_t Job_t;
+struct Job_t {
+    // called on a worker, then on the loop
+    JobFunc work;
+    JobFunc done;
     void *data;
-} KeyVal_t;
+    Job_t *next;
+    uint32_t priority;
+    // NowUsec() when queued, and when to give up if not started; 0 is never
+    uint64_t queued;
+    uint64_t deadline;
+    // dropped unstarted; work was not called
+    bool expired;
+};
+
+typedef struct {
+    pthread_mutex_t lock;
+    Job_t *head[RENDER_PRIORITIES];
+    Job_t *tail[RENDER_PRIORITIES];
+    // worker of this queue is running
+    bool alive;
+} JobQueue_t;
+
+typedef struct {
+    JobQueue_t queues[RENDER_POOL_MAX];
+    // queues ever used; workers steal from all of them
+    uint32_t nqueues;
+    // wanted workers; new jobs go round-robin to their queues
+    uint32_t size;
+    uint32_t rr;
+    // queued jobs not taken by a worker yet
+    uint32_t pending;
+    // admission control; touched from main thread only. waiting counts
+    // renders queued for a free replica of their parser.
+    uint32_t waiting;
+    uint32_t maxQueue;
+    uint64_t rejected;
+    // queue wait of started jobs, expired jobs
+    uint64_t jobs;
+    uint64_t waitTime;
+    uint64_t waitTimeMax;
+    uint64_t expired;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    // finished jobs waiting for the loop
+    pthread_mutex_t doneLock;
+    Job_t *done;
+    Job_t *doneTail;
+    ev_async notify;
+    bool started;
+} RenderPool_t;
+
+static RenderPool_t RenderPool;
+
+static inline Job_t *PopJob( JobQueue_t *queue, uint32_t level )
+{
+    Job_t *job = NULL;
+    
+    // unlocked peek; an empty level is skipped without taking the lock
+    if( !queue->head[level] ){
+        return NULL;
+    }
+    pthread_mutex_lock( &queue->lock );
+    if( ( job = queue->head[level] ) && !( queue->head[level] = job->next ) ){
+        queue->tail[level] = NULL;
+    }
+    pthread_mutex_unlock( &queue->lock );
+    
+    return job;
+}
+
+static void *RenderWorker( void *arg )
+{
+    RenderPool_t *pool = &RenderPool;
+    uint32_t id = (uint32_t)(uintptr_t)arg;
+    uint32_t level = 0;
+    uint32_t i = 0;
+    uint64_t now = 0;
+    Job_t *job = NULL;
+    
+    while( 1 )
+    {
+        // highest priority first; own queue, then steal from the others
+        for( job = NULL, level = RENDER_PRIORITIES; !job && level--; )
+        {
+            job = PopJob( &pool->queues[id], level );
+            for( i = 1; !job && i < pool->nqueues; i++ ){
+                job = PopJob( &pool->queues[( id + i ) % pool->nqueues], level );
+            }
+        }
+        
+        if( job )
+        {
+            __sync_sub_and_fetch( &pool->pending, 1 );
+            now = NowUsec();
+            // nobody waits for the result anymore
+            if( job->deadline && job->deadline <= now ){
+                job->expired = true;
+                __sync_add_and_fetch( &pool->expired, 1 );
+            }
+            else {
+                __sync_add_and_fetch( &pool->jobs, 1 );
+                __sync_add_and_fetch( &pool->waitTime, now - job->queued );
+                StatMax( &pool->waitTimeMax, now - job->queued );
+                job->work( job->data );
+            }
+            job->next = NULL;
+            pthread_mutex_lock( &pool->doneLock );
+            if( pool->doneTail ){
+                pool->doneTail->next = job;
+            }
+            else {
+                pool->done = job;
+            }
+            pool->doneTail = job;
+            pthread_mutex_unlock( &pool->doneLock );
+            // sends before the loop wakes up are merged into one callback
+            ev_async_send( EV_DEFAULT_UC, &pool->notify );
+            continue;
+        }
+        
+        pthread_mutex_lock( &pool->lock );
+        // retired by a smaller pool; what is left in the queue gets stolen
+        if( id >= pool->size ){
+            pool->queues[id].alive = false;
+            pthread_mutex_unlock( &pool->lock );
+            break;
+        }
+        if( !pool->pending ){
+            pthread_cond_wait( &pool->cond, &pool->lock );
+        }
+        pthread_mutex_unlock( &pool->lock );
+    }
+    
+    return NULL;
+}
+
+// run done callbacks of every job finished since the last wakeup
+static void RenderPoolDone( EV_P_ ev_async *watcher, int revents )
+{
+    RenderPool_t *pool = &RenderPool;
+    Job_t *job = NULL;
+    Job_t *next = NULL;
+    
+    (void)watcher;
+    (void)revents;
+    pthread_mutex_lock( &pool->doneLock );
+    job = pool->done;
+    pool->done = pool->doneTail = NULL;
+    pthread_mutex_unlock( &pool->doneLock );
+    
+    while( job ){
+        next = job->next;
+        job->done( job->data );
+        job = next;
+    }
+}
+
+// start the pool on first use and set the number of workers; called
+// from main thread only
+static int RenderPoolResize( uint32_t size )
+{
+    RenderPool_t *pool = &RenderPool;
+    pthread_attr_t attr;
+    pthread_t tid;
+    uint32_t i = 0;
+    int rc = 0;
+    
+    if( !pool->started )
+    {
+        if( ( rc = pthread_mutex_init( &pool->lock, NULL ) ) ){
+            return rc;
+        }
+        else if( ( rc = pthread_cond_init( &pool->cond, NULL ) ) ){
+            pthread_mutex_destroy( &pool->lock );
+            return rc;
+        }
+        else if( ( rc = pthread_mutex_init( &pool->doneLock, NULL ) ) ){
+            pthread_cond_destroy( &pool->cond );
+            pthread_mutex_destroy( &pool->lock );
+            return rc;
+        }
+        ev_async_init( &pool->notify, RenderPoolDone );
+        ev_async_start( EV_DEFAULT_UC, &pool->notify );
+        // pending jobs hold the loop by themselves
+        ev_unref( EV_DEFAULT_UC );
+        pool->started = true;
+    }
+    
+    if( !size ){
+        size = NumCPU();
+    }
+    if( size > RENDER_POOL_MAX ){
+        size = RENDER_POOL_MAX;
+    }
+    
+    pthread_attr_init( &attr );
+    pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+    pthread_mutex_lock( &pool->lock );
+    for( i = 0; i < size; i++ )
+    {
+        JobQueue_t *queue = &pool->queues[i];
+        
+        if( queue->alive ){
+            continue;
+        }
+        else if( i >= pool->nqueues )
+        {
+            if( ( rc = pthread_mutex_init( &queue->lock, NULL ) ) ){
+                break;
+            }
+            pool->nqueues = i + 1;
+        }
+        if( ( rc = pthread_create( &tid, &attr, RenderWorker, (void*)(uintptr_t)i ) ) ){
+            break;
+        }
+        queue->alive = true;
+    }
+    // keep the workers that did start
+    pool->size = ( i ) ? i : pool->size;
+    // wake idle workers to retire
+    pthread_cond_broadcast( &pool->cond );
+    pthread_mutex_unlock( &pool->lock );
+    pthread_attr_destroy( &attr );
+    
+    return rc;
+}
+
+static inline int RenderPoolSubmit( Job_t *job )
+{
+    RenderPool_t *pool = &RenderPool;
+    JobQueue_t *queue = NULL;
+    int rc = 0;
+    
+    // no worker could be started so far
+    if( !pool->size && ( rc = RenderPoolResize( 0 ) ) && !pool->size ){
+        return rc;
+    }
+    
+    job->next = NULL;
+    if( job->priority >= RENDER_PRIORITIES ){
+        job->priority = RENDER_PRIORITIES - 1;
+    }
+    if( !job->queued ){
+        job->queued = NowUsec();
+    }
+    pthread_mutex_lock( &pool->lock );
+    queue = &pool->queues[pool->rr++ % pool->size];
+    pthread_mutex_lock( &queue->lock );
+    if( queue->tail[job->priority] ){
+        queue->tail[job->priority]->next = job;
+    }
+    else {
+        queue->head[job->priority] = job;
+    }
+    queue->tail[job->priority] = job;
+    pthread_mutex_unlock( &queue->lock );
+    __sync_add_and_fetch( &pool->pending, 1 );
+    pthread_cond_signal( &pool->cond );
+    pthread_mutex_unlock( &pool->lock );
+    
+    return 0;
+}
 
 typedef struct {
     void *ctx;
@@ -91,9 +711,44 @@ typedef struct {
     Persistent<Function> callback;
     NEOERR *nerr;
     void *data;
-    eio_req *req;
+    // request-local HDF overlay, or Config of the parser for async compile
+    HDF *hdf;
+    // render slot checked out from the parser pool
+    Replica_t *rep;
+    // cached output in place of the replica page
+    OutCache_t *hit;
+    // deliver result as Buffer instead of String
+    bool buffer;
+    Job_t job;
+    // next baton waiting for a free replica
+    void *next;
+    // async parseString: source length, compiled tree, remove parser on failure
+    size_t len;
+    Tree_t *tree;
+    bool isTmp;
+    // order of the compile; an older one finishing late is not installed
+    uint32_t seq;
 } Baton_t;
 
+// snapshot file header; all fields in host byte order
+#define SNAPSHOT_MAGIC      "NCSS"
+#define SNAPSHOT_VERSION    1
+#define SNAPSHOT_BYTEORDER  0x01020304
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t byteorder;
+    // ne_crc of body
+    uint32_t crc;
+    uint32_t nparsers;
+    uint32_t nfiles;
+    uint32_t npaths;
+    uint32_t bodylen;
+} SnapshotHeader_t;
+
+// default seconds an unused replica is kept in the pool
+#define REPLICA_IDLE_SEC    30
+
 
 static inline char *TypeName( Handle<Value> v )
 {
@@ -116,10 +771,34 @@ static inline uint32_t TypeOf( Handle<Value> v )
     else if( v->IsUndefined() ){
         flag |= JS_TYPE_UNDEFINED_BIT;
     }
+    // leaves of a view model are classified without allocation
+    else if( v->IsString() ){
+        flag |= JS_TYPE_STRING_BIT;
+    }
+    else if( v->IsNumber() ){
+        flag |= JS_TYPE_NUMBER_BIT;
+    }
+    else if( v->IsBoolean() ){
+        flag |= JS_TYPE_BOOLEAN_BIT;
+    }
+    else if( v->IsArray() ){
+        flag |= JS_TYPE_ARRAY_BIT;
+    }
+    else if( v->IsDate() ){
+        flag |= JS_TYPE_DATE_BIT;
+    }
+    else if( v->IsRegExp() ){
+        flag |= JS_TYPE_REGEXP_BIT;
+    }
+    else if( v->IsFunction() ){
+        flag |= JS_TYPE_FUNCTION_BIT;
+    }
+    // plain object or boxed primitive
     else
     {
         Local<Object> obj = v->ToObject();
-        char *proto = *String::Utf8Value( obj->ObjectProtoToString() );
+        String::Utf8Value str( obj->ObjectProtoToString() );
+        char *proto = *str;
         
         for( int i = 0; i < JS_TYPE_NULL; i++ )
         {
@@ -186,6 +865,7 @@ static inline int CurrentTimestamp( char **str )
 // MARK: @interface
 class ClearSilver : public ObjectWrap
 {
+    friend class RenderStream;
     // MARK: @public
     public:
         ClearSilver(){};
@@ -199,9 +879,60 @@ class ClearSilver : public ObjectWrap
         // cache
         NE_HASH *parseCache;
         NE_HASH *fileCache;
+        NE_HASH *pathCache;
+        // file cache lru list: head is most recently used
+        FileCache_t *lruHead;
+        FileCache_t *lruTail;
+        // entries read from disk without the lock, linked by next; threads
+        // including one of them wait on loaded
+        FileCache_t *loading;
+        pthread_cond_t loaded;
+        size_t cacheBytes;
+        size_t cacheMaxBytes;
+        uint32_t cacheCheck;
+        // file cache stats
+        uint64_t cacheHits;
+        uint64_t cacheMisses;
+        uint64_t cacheEvictions;
+        uint64_t cacheInvalidations;
+        uint64_t pathHits;
+        uint64_t pathMisses;
+        // fallback of parser lookups; swapped under mutex
+        Global_t *global;
+        // rendered output cache, off while outTTL is 0; own mutex as
+        // every render looks it up. lru list: head is most recently used
+        pthread_mutex_t outMutex;
+        NE_HASH *outCache;
+        OutCache_t *outHead;
+        OutCache_t *outTail;
+        size_t outBytes;
+        size_t outMaxBytes;
+        uint64_t outTTL;
+        uint64_t outHits;
+        uint64_t outMisses;
+        // fragment outputs holding "<?cs", rendered but not kept
+        uint64_t outUncacheable;
+        // cacheable includes by realpath; under mutex
+        NE_HASH *fragments;
+        
+        // cache control; call with mutex locked
+        FileCache_t *_cacheLookup( const char *path );
+        NEOERR *_cacheLoad( const char *path, FileCache_t **entry );
+        void _cacheRemove( FileCache_t *entry );
+        bool _pathLookup( const char *key, char **resolve );
+        void _pathStore( const char *key, const char *resolve );
+        void _outRemove( OutCache_t *entry );
+        // output cache; lock outMutex by themselves
+        OutCache_t *_outAcquire( OutCache_t *key );
+        char *_outLookup( OutCache_t *key );
+        void _outStore( OutCache_t *key, STRING *page, uint64_t ttl );
+        static Handle<Value> setCacheOptions( const Arguments &argv );
+        static Handle<Value> setRenderPool( const Arguments &argv );
+        static Handle<Value> renderPoolStats( const Arguments &argv );
+        static Handle<Value> cacheStats( const Arguments &argv );
+        static Handle<Value> cacheFragment( const Arguments &argv );
         // TODO: impl cache control
         // static Handle<Value> cachedParsers( const Arguments &argv );
-        // static Handle<Value> cachedFiles( const Arguments &argv );
         
         // new
         static Handle<Value> New( const Arguments& argv );
@@ -209,96 +940,523 @@ class ClearSilver : public ObjectWrap
         Handle<Value> _createParser( Handle<Value> id, ParseCtx_t **context );
         static Handle<Value> createParser( const Arguments &argv );
         static Handle<Value> removeParser( const Arguments &argv );
+        static NEOERR *_compile( ParseCtx_t *ctx, HDF *hdf, const char *src, size_t len, Tree_t **tree );
         static Handle<Value> parseString( const Arguments &argv );
+        static int parseStringBeginEIO( eio_req *req );
+        static int parseStringEndEIO( eio_req *req );
+        static Handle<Value> replaceTemplate( const Arguments &argv );
+        
+        // snapshot
+        NEOERR *_cacheLink( FileCache_t *cache );
+        static Handle<Value> saveSnapshot( const Arguments &argv );
+        static Handle<Value> loadSnapshot( const Arguments &argv );
+        
+        // preload
+        static Handle<Value> preload( const Arguments &argv );
+        static int preloadScanEIO( eio_req *req );
+        static int preloadScanEndEIO( eio_req *req );
+        static int preloadBeginEIO( eio_req *req );
+        static int preloadEndEIO( eio_req *req );
         
         // render
-        static int renderBeginEIO( eio_req *req );
-        static int renderEndEIO( eio_req *req );
+        static Handle<Value> _createOverlay( Handle<Value> data, HDF **overlay );
+        static NEOERR *_render( ParseCtx_t *ctx, HDF *overlay, void *out, CSOUTFUNC cb, OutCache_t **hit );
+        static void renderWork( void *data );
+        static void renderDone( void *data );
+        static Handle<Value> _render( const Arguments &argv, const char *fname, bool buffer );
         static Handle<Value> render( const Arguments &argv );
+        static Handle<Value> renderBuffer( const Arguments &argv );
+        static Handle<Value> renderStream( const Arguments &argv );
+        static Handle<Value> renderMany( const Arguments &argv );
+        static void renderManyWork( void *data );
+        static void renderManyDone( void *data );
         
         // callback and hook
         static NEOERR *callbackRender( void *ctx, char *str );
         static NEOERR *hookFileload( void *ctx, HDF *hdf, const char *filepath, char **inject );
+        static NEOERR *_renderFragment( ParseCtx_t *ctx, HDF *hdf, HDF *fallback, const char *id, OutCache_t *key, size_t base, uint64_t ttl, char **inject );
+        bool _depsFresh( const char *deps, size_t len );
     
         // setter/getter
-        static Handle<Value> _setValue( HDF *hdf, Local<Object> obj, const char *const parentKey, Local<Array> refs );
+        static Handle<Value> _setValue( HDF *hdf, Local<Object> obj, Local<Array> props, ConvBuf_t *conv, Ancestors_t *path );
+        static Handle<Value> _setObject( HDF *hdf, const char *key, Local<Object> obj, bool *removed = NULL );
+        static NEOERR *_fingerprint( Local<Object> obj, Local<Array> props, ConvBuf_t *conv, Ancestors_t *path, Prints_t *prints );
+        static NEOERR *_diffValue( HDF *hdf, HDF *shadow, Local<Object> obj, Local<Array> props, ConvBuf_t *conv, Ancestors_t *path, Prints_t *prints, uint32_t *cursor );
+        static Handle<Value> _diffObject( ParseCtx_t *ctx, const char *key, Local<Object> obj );
         static Handle<Value> setValue( const Arguments& argv );
         static Handle<Value> getValue( const Arguments& argv );
         static Handle<Value> removeValue( const Arguments& argv );
         static Handle<Value> dump( const Arguments &argv );
+        
+        // node handle
+        static NEOERR *_resolveNode( ParseCtx_t *ctx, HDFNode *handle, bool create, HDF **node );
+        static Handle<Value> resolveNode( const Arguments &argv );
+        static Handle<Value> setNodeValue( const Arguments &argv );
+        static Handle<Value> getNodeValue( const Arguments &argv );
+        
+        // global HDF
+        static Handle<Value> setGlobal( const Arguments &argv );
+        
+        // stats
+        static Handle<Value> stats( const Arguments &argv );
+        static Handle<Value> resetStats( const Arguments &argv );
 
         // TODO: impl parseFile
         // static Handle<Value> parseFile( const Arguments &argv );
-        // static int parseStringBeginEIO( eio_req *req );
-        // static int parseStringEndEIO( eio_req *req );
         // TODO: impl HDF setter/getter
         // static Handle<Value> parseString( const Arguments &argv );
 };
 
+// per parser counters, updated with atomic adds; times in usec
+#define STATS_HIST_BUCKETS  20
+typedef struct {
+    uint64_t parses;
+    uint64_t parseTime;
+    uint64_t parseTimeLast;
+    uint64_t renders;
+    uint64_t renderErrors;
+    uint64_t renderTime;
+    uint64_t renderTimeMax;
+    // renders by log2 of usec
+    uint64_t hist[STATS_HIST_BUCKETS];
+    uint64_t outputBytes;
+    // waiting for ctx->lock in render
+    uint64_t lockWait;
+    uint64_t includeHits;
+    uint64_t includeMisses;
+} Stats_t;
+
+static inline void StatRender( Stats_t *stats, uint64_t usec, uint64_t bytes, bool failed )
+{
+    uint32_t bucket = 0;
+    
+    while( bucket < STATS_HIST_BUCKETS - 1 && ( usec >> ( bucket + 1 ) ) ){
+        bucket++;
+    }
+    __sync_add_and_fetch( &stats->renders, 1 );
+    __sync_add_and_fetch( &stats->renderTime, usec );
+    __sync_add_and_fetch( &stats->hist[bucket], 1 );
+    __sync_add_and_fetch( &stats->outputBytes, bytes );
+    if( failed ){
+        __sync_add_and_fetch( &stats->renderErrors, 1 );
+    }
+    StatMax( &stats->renderTimeMax, usec );
+}
+
 struct ParseCtx_t {
     const char *id;
     ClearSilver *cs;
     HDF *hdf;
-    CSPARSE *csp;
-    pthread_mutex_t mutex;
+    // current compiled template; swapped under treeLock
+    Tree_t *tree;
+    pthread_mutex_t treeLock;
+    // compiles started and the latest one installed
+    uint32_t treeSeq;
+    uint32_t treeInstalled;
+    // template source of csp
+    char *src;
+    size_t srclen;
+    // compiled from snapshot; verified by next parseString
+    bool snapshot;
+    // shared by overlay renders, exclusive for writers of hdf/csp
+    pthread_rwlock_t lock;
+    // render replicas; touched from main thread only
+    Replica_t *pool;
+    uint32_t npool;
+    uint32_t nbusy;
+    uint32_t poolMax;
+    uint32_t poolIdle;
+    // renders waiting for a replica
+    Baton_t *pending;
+    Baton_t *pendingTail;
+    // registry entry plus one per in-flight async operation; the last
+    // release destroys the context
+    uint32_t refs;
+    // fingerprints of diff mode setValue, mirroring the data tree;
+    // dropped by any other write to hdf
+    HDF *prints;
+    // unique per context, so a recycled address is not the same parser
+    uint32_t serial;
+    // bumped whenever nodes of hdf may have been freed
+    uint32_t generation;
+    // bumped by every write to hdf
+    uint32_t version;
+    // copy of hdf at its version for overlay renders, which hold no lock
+    // while they render; rebuilt under frozenLock once version moved on
+    Global_t *frozen;
+    pthread_mutex_t frozenLock;
+    Stats_t stats;
 };
 
-static ParseCtx_t *CreateContext( const char *id, char **estr )
+static uint32_t ParserSerial = 0;
+
+// slot for one in-flight render of a parser. the output buffer is kept
+// across renders so hot templates stop paying for STRING growth.
+struct Replica_t {
+    STRING page;
+    // size of the last output handed to a Buffer; reserved for the next
+    int hint;
+    time_t atime;
+    Replica_t *next;
+};
+
+static inline void DestroyReplica( Replica_t *rep )
 {
-    ParseCtx_t *ctx = NULL;
+    string_clear( &rep->page );
+    free( rep );
+}
+
+// release replicas idle longer than ctx->poolIdle. the pool is kept in
+// most-recently-used order, so idle replicas sit at the tail.
+static void ShrinkReplica( ParseCtx_t *ctx, time_t now )
+{
+    Replica_t **ptr = &ctx->pool;
     
-    if( !( ctx = (ParseCtx_t*)calloc( 1, sizeof( ParseCtx_t ) ) ) ){
-        asprintf( estr, "%s", strerror(errno) );
-        return NULL;
-    }
-    // init hdf
-    else if( ( *estr = CHECK_NEOERR( hdf_init( &ctx->hdf ) ) ) ){
-        free( ctx );
-        return NULL;
+    while( *ptr && (*ptr)->atime + ctx->poolIdle >= now ){
+        ptr = &(*ptr)->next;
     }
-    else if( id )
+    while( *ptr )
     {
-        if( -1 == asprintf( (char**)&ctx->id, "%s", id ) ){
-            asprintf( estr, "%s", strerror(errno) );
-            hdf_destroy(&ctx->hdf);
-            free(ctx);
-            return NULL;
-        }
+        Replica_t *rep = *ptr;
+        *ptr = rep->next;
+        DestroyReplica( rep );
+        ctx->npool--;
     }
-    else
-    {
-        if( 0 != CurrentTimestamp( (char**)&ctx->id ) ){
-            asprintf( estr, "%s", strerror(errno) );
-            hdf_destroy(&ctx->hdf);
-            free( ctx );
-            return NULL;
-        }
+}
+
+// reset output; after a Buffer took the last one, reserve its size
+static inline void ReserveReplica( Replica_t *rep )
+{
+    if( rep->page.buf ){
+        rep->page.len = 0;
+        rep->page.buf[0] = 0;
+    }
+    else if( rep->hint && ( rep->page.buf = (char*)malloc( rep->hint ) ) ){
+        rep->page.max = rep->hint;
+        rep->page.buf[0] = 0;
     }
-    return ctx;
 }
 
-static inline void DestroyContext( ParseCtx_t *ctx )
+// returns NULL if ctx->poolMax replicas are busy and force is false
+static Replica_t *CheckoutReplica( ParseCtx_t *ctx, bool force )
 {
-    if( ctx )
-    {
-        pthread_mutex_lock( &ctx->mutex );
-        //printf( "    id: %s\n", ctx->id );
+    Replica_t *rep = NULL;
+    
+    ShrinkReplica( ctx, time(NULL) );
+    if( ( rep = ctx->pool ) ){
+        ctx->pool = rep->next;
+        ctx->npool--;
+    }
+    // grow on demand
+    else if( ( ctx->nbusy < ctx->poolMax || force ) &&
+             ( rep = (Replica_t*)calloc( 1, sizeof( Replica_t ) ) ) ){
+        string_init( &rep->page );
+    }
+    
+    if( rep ){
+        rep->next = NULL;
+        ctx->nbusy++;
+        ReserveReplica( rep );
+    }
+    
+    return rep;
+}
+
+static void FreeBuffer( char *data, void *hint )
+{
+    (void)hint;
+    free( data );
+}
+
+static void ReleaseOutBuffer( char *data, void *hint )
+{
+    (void)data;
+    ReleaseOut( (OutCache_t*)hint );
+}
+
+// hand a cache hit over; a String is copied by V8, a Buffer shares the
+// entry's bytes and holds its reference until collected
+static inline Local<Value> OutToString( OutCache_t *entry )
+{
+    Local<Value> str = String::New( ( entry->data ) ? entry->data : "", entry->len );
+    
+    ReleaseOut( entry );
+    return str;
+}
+
+static inline Local<Value> OutToBuffer( OutCache_t *entry )
+{
+    Buffer *buf = NULL;
+    
+    if( !entry->data ){
+        buf = Buffer::New( 0 );
+        ReleaseOut( entry );
+    }
+    else {
+        buf = Buffer::New( entry->data, entry->len, ReleaseOutBuffer, (void*)entry );
+    }
+    
+    return Local<Value>::New( buf->handle_ );
+}
+
+static inline Local<Value> ReplicaToString( Replica_t *rep )
+{
+    return String::New( ( rep->page.buf ) ? rep->page.buf : "", rep->page.len );
+}
+
+// hand the rendered bytes over to a Buffer without copying; the buffer
+// is trimmed to the output, so a Buffer does not keep growth slack
+static inline Local<Value> ReplicaToBuffer( Replica_t *rep )
+{
+    Buffer *buf = NULL;
+    char *data = NULL;
+    
+    if( !rep->page.buf ){
+        buf = Buffer::New( 0 );
+    }
+    else
+    {
+        if( rep->page.max > rep->page.len + 1 &&
+            ( data = (char*)realloc( rep->page.buf, rep->page.len + 1 ) ) ){
+            rep->page.buf = data;
+        }
+        buf = Buffer::New( rep->page.buf, rep->page.len, FreeBuffer, NULL );
+        rep->hint = rep->page.len + 1;
+        string_init( &rep->page );
+    }
+    
+    return Local<Value>::New( buf->handle_ );
+}
+
+static void CheckinReplica( ParseCtx_t *ctx, Replica_t *rep )
+{
+    time_t now = time(NULL);
+    
+    ctx->nbusy--;
+    // forced replica over the cap
+    if( ctx->nbusy + ctx->npool >= ctx->poolMax ){
+        DestroyReplica( rep );
+    }
+    else
+    {
+        rep->atime = now;
+        rep->next = ctx->pool;
+        ctx->pool = rep;
+        ctx->npool++;
+    }
+    ShrinkReplica( ctx, now );
+}
+
+// writers of the parser run on the event loop; prefer them so a steady
+// flow of readers cannot hold them off
+static inline int InitParserLock( pthread_rwlock_t *lock )
+{
+    pthread_rwlockattr_t attr;
+    int rc = 0;
+    
+    if( ( rc = pthread_rwlockattr_init( &attr ) ) ){
+        return rc;
+    }
+#ifdef __GLIBC__
+    pthread_rwlockattr_setkind_np( &attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP );
+#endif
+    rc = pthread_rwlock_init( lock, &attr );
+    pthread_rwlockattr_destroy( &attr );
+    
+    return rc;
+}
+
+static ParseCtx_t *CreateContext( const char *id, char **estr )
+{
+    ParseCtx_t *ctx = NULL;
+    
+    if( !( ctx = (ParseCtx_t*)calloc( 1, sizeof( ParseCtx_t ) ) ) ){
+        asprintf( estr, "%s", strerror(errno) );
+        return NULL;
+    }
+    // init hdf
+    else if( ( *estr = CHECK_NEOERR( hdf_init( &ctx->hdf ) ) ) ){
+        free( ctx );
+        return NULL;
+    }
+    else if( ( errno = InitParserLock( &ctx->lock ) ) ){
+        asprintf( estr, "%s", strerror(errno) );
+        hdf_destroy(&ctx->hdf);
+        free( ctx );
+        return NULL;
+    }
+    else if( ( errno = pthread_mutex_init( &ctx->treeLock, NULL ) ) ){
+        asprintf( estr, "%s", strerror(errno) );
+        pthread_rwlock_destroy( &ctx->lock );
+        hdf_destroy(&ctx->hdf);
+        free( ctx );
+        return NULL;
+    }
+    else if( ( errno = pthread_mutex_init( &ctx->frozenLock, NULL ) ) ){
+        asprintf( estr, "%s", strerror(errno) );
+        pthread_mutex_destroy( &ctx->treeLock );
+        pthread_rwlock_destroy( &ctx->lock );
+        hdf_destroy(&ctx->hdf);
+        free( ctx );
+        return NULL;
+    }
+    
+    ctx->poolMax = ( RenderPool.size ) ? RenderPool.size : NumCPU();
+    ctx->poolIdle = REPLICA_IDLE_SEC;
+    ctx->serial = __sync_add_and_fetch( &ParserSerial, 1 );
+    ctx->refs = 1;
+    if( id )
+    {
+        if( -1 == asprintf( (char**)&ctx->id, "%s", id ) ){
+            asprintf( estr, "%s", strerror(errno) );
+            pthread_mutex_destroy( &ctx->frozenLock );
+            pthread_mutex_destroy( &ctx->treeLock );
+            pthread_rwlock_destroy( &ctx->lock );
+            hdf_destroy(&ctx->hdf);
+            free(ctx);
+            return NULL;
+        }
+    }
+    else
+    {
+        if( 0 != CurrentTimestamp( (char**)&ctx->id ) ){
+            asprintf( estr, "%s", strerror(errno) );
+            pthread_mutex_destroy( &ctx->frozenLock );
+            pthread_mutex_destroy( &ctx->treeLock );
+            pthread_rwlock_destroy( &ctx->lock );
+            hdf_destroy(&ctx->hdf);
+            free( ctx );
+            return NULL;
+        }
+    }
+    return ctx;
+}
+
+static inline void DestroyContext( ParseCtx_t *ctx )
+{
+    if( ctx )
+    {
+        pthread_rwlock_wrlock( &ctx->lock );
+        //printf( "    id: %s\n", ctx->id );
         if( ctx->id ){
             free( (void*)ctx->id );
         }
-        if( ctx->csp ){
-            //printf( "    csp: %p\n", ctx->csp );
-            cs_destroy(&ctx->csp);
+        //printf( "    tree: %p\n", ctx->tree );
+        ReleaseTree( ctx->tree );
+        ReleaseGlobal( ctx->frozen );
+        free( ctx->src );
+        if( ctx->prints ){
+            hdf_destroy(&ctx->prints);
         }
         //printf( "    hdf: %p\n", ctx->hdf );
         hdf_destroy(&ctx->hdf);
-        pthread_mutex_unlock( &ctx->mutex );
-        pthread_mutex_destroy(&ctx->mutex);
+        while( ctx->pool )
+        {
+            Replica_t *rep = ctx->pool;
+            ctx->pool = rep->next;
+            DestroyReplica( rep );
+        }
+        pthread_rwlock_unlock( &ctx->lock );
+        pthread_rwlock_destroy( &ctx->lock );
+        pthread_mutex_destroy( &ctx->treeLock );
+        pthread_mutex_destroy( &ctx->frozenLock );
         //printf( "    free ctx: %p\n", ctx );
         free( ctx );
     }
 }
 
+static inline ParseCtx_t *RetainContext( ParseCtx_t *ctx )
+{
+    __sync_add_and_fetch( &ctx->refs, 1 );
+    return ctx;
+}
+
+// drop a reference; removing a parser only drops the registry's one, so
+// renders still holding ctx finish before it is destroyed
+static inline void ReleaseContext( ParseCtx_t *ctx )
+{
+    if( ctx && 0 == __sync_sub_and_fetch( &ctx->refs, 1 ) ){
+        DestroyContext( ctx );
+    }
+}
+
+
+// default bytes per chunk of streaming render
+#define STREAM_CHUNK_SIZE   16384
+// chunks buffered before the render thread waits for the reader
+#define STREAM_QUEUE_MAX    2
+
+typedef struct Chunk_t Chunk_t;
+struct Chunk_t {
+    char *buf;
+    size_t len;
+    Chunk_t *next;
+};
+
+// MARK: @interface
+class RenderStream : public EventEmitter
+{
+    // MARK: @public
+    public:
+        RenderStream(){};
+        ~RenderStream();
+        static Persistent<FunctionTemplate> constructor_template;
+        static void Initialize( Handle<Object> target );
+        static Handle<Value> Create( ParseCtx_t *ctx, HDF *overlay, size_t chunkSize );
+    // MARK: @private
+    private:
+        ParseCtx_t *ctx;
+        HDF *hdf;
+        size_t chunkSize;
+        // chunk being filled by the render thread
+        STRING page;
+        // chunks waiting for delivery
+        Chunk_t *head;
+        Chunk_t *tail;
+        uint32_t nqueue;
+        bool paused;
+        bool aborted;
+        bool done;
+        bool ended;
+        NEOERR *nerr;
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        ev_async notify;
+        
+        static Handle<Value> New( const Arguments &argv );
+        static Handle<Value> pause( const Arguments &argv );
+        static Handle<Value> resume( const Arguments &argv );
+        static Handle<Value> destroy( const Arguments &argv );
+        
+        static void *renderThread( void *data );
+        static void callbackAsync( EV_P_ ev_async *watcher, int revents );
+        static NEOERR *callbackRender( void *ctx, char *str );
+        NEOERR *push( void );
+        void flush( void );
+};
+
+// key path of a parser resolved to its HDF node; the node is looked up
+// again when the parser was replaced or nodes were removed since
+class HDFNode : public ObjectWrap
+{
+    friend class ClearSilver;
+    // MARK: @public
+    public:
+        HDFNode(){};
+        ~HDFNode();
+        static Persistent<FunctionTemplate> constructor_template;
+        static void Initialize( Handle<Object> target );
+    // MARK: @private
+    private:
+        char *id;
+        char *key;
+        uint32_t serial;
+        uint32_t generation;
+        HDF *node;
+        
+        static Handle<Value> New( const Arguments &argv );
+};
+
 
 // MARK: @implements
 
@@ -325,27 +1483,45 @@ ClearSilver::~ClearSilver()
                 // nanosleep( &rem, NULL );
                 void *data = ne_hash_remove( parseCache, node->key );
                 //printf( "DestroyContext[%d]: %p\n", ndestroy, (char*)node->key );
-                DestroyContext( (ParseCtx_t*)data );
+                ReleaseContext( (ParseCtx_t*)data );
                 node = next;
             }
         }
     }
     ne_hash_destroy( &parseCache );
     // cleanup include cache
-    for( bkt = 0; bkt < fileCache->size; bkt++ )
+    while( lruHead ){
+        _cacheRemove( lruHead );
+    }
+    ne_hash_destroy( &fileCache );
+    // cleanup resolved path cache
+    for( bkt = 0; bkt < pathCache->size; bkt++ )
     {
-        if( ( node = fileCache->nodes[bkt] ) )
+        for( node = pathCache->nodes[bkt]; node; node = node->next )
         {
-            while (node) {
-                next = node->next;
-                ne_hash_remove( fileCache, node->key );
-                free( node->key );
-                free( node->value );
-                node = next;
-            }
+            PathCache_t *entry = (PathCache_t*)node->value;
+            free( entry->path );
+            free( entry->id );
+            free( entry );
         }
     }
-    ne_hash_destroy( &fileCache );
+    ne_hash_destroy( &pathCache );
+    // cleanup output cache
+    while( outHead ){
+        _outRemove( outHead );
+    }
+    ne_hash_destroy( &outCache );
+    pthread_mutex_destroy( &outMutex );
+    // cleanup fragment declarations
+    for( bkt = 0; bkt < fragments->size; bkt++ )
+    {
+        for( node = fragments->nodes[bkt]; node; node = node->next ){
+            DestroyFragment( (Fragment_t*)node->value );
+        }
+    }
+    ne_hash_destroy( &fragments );
+    ReleaseGlobal( global );
+    pthread_cond_destroy( &loaded );
     pthread_mutex_destroy( &mutex );
 }
 
@@ -358,17 +1534,44 @@ Handle<Value> ClearSilver::New( const Arguments& argv )
     
     // init cache
     if( ( estr = CHECK_NEOERR( ne_hash_init( &cs->parseCache, ne_hash_str_hash, ne_hash_str_comp ) ) ) ||
-        ( estr = CHECK_NEOERR( ne_hash_init( &cs->fileCache, ne_hash_str_hash, ne_hash_str_comp ) ) ) )
+        ( estr = CHECK_NEOERR( ne_hash_init( &cs->fileCache, ne_hash_str_hash, ne_hash_str_comp ) ) ) ||
+        ( estr = CHECK_NEOERR( ne_hash_init( &cs->pathCache, ne_hash_str_hash, ne_hash_str_comp ) ) ) ||
+        ( estr = CHECK_NEOERR( ne_hash_init( &cs->outCache, OutCacheHash, OutCacheComp ) ) ) ||
+        ( estr = CHECK_NEOERR( ne_hash_init( &cs->fragments, ne_hash_str_hash, ne_hash_str_comp ) ) ) )
     {
         pthread_mutex_destroy( &cs->mutex);
         if( cs->parseCache ){
             ne_hash_destroy( &cs->parseCache );
         }
+        if( cs->fileCache ){
+            ne_hash_destroy( &cs->fileCache );
+        }
+        if( cs->pathCache ){
+            ne_hash_destroy( &cs->pathCache );
+        }
+        if( cs->outCache ){
+            ne_hash_destroy( &cs->outCache );
+        }
         retval = ThrowException( Exception::Error( String::New( estr ) ) );
         free( (void*)estr );
     }
     else {
         pthread_mutex_init( &cs->mutex, NULL );
+        pthread_cond_init( &cs->loaded, NULL );
+        cs->lruHead = cs->lruTail = NULL;
+        cs->loading = NULL;
+        cs->cacheBytes = 0;
+        cs->cacheMaxBytes = FILECACHE_MAX_BYTES;
+        cs->cacheCheck = FILECACHE_CHECK_SEC;
+        cs->cacheHits = cs->cacheMisses = cs->cacheEvictions = cs->cacheInvalidations = 0;
+        cs->pathHits = cs->pathMisses = 0;
+        cs->global = NULL;
+        pthread_mutex_init( &cs->outMutex, NULL );
+        cs->outHead = cs->outTail = NULL;
+        cs->outBytes = 0;
+        cs->outMaxBytes = OUTCACHE_MAX_BYTES;
+        cs->outTTL = 0;
+        cs->outHits = cs->outMisses = cs->outUncacheable = 0;
         cs->Wrap( argv.This() );
         retval = argv.This();
     }
@@ -376,600 +1579,4254 @@ Handle<Value> ClearSilver::New( const Arguments& argv )
 }
 
 // MARK: cache control
-/*
-NEOERR* ClearSilver::addCache( const char *cache_id, void *cache )
+
+// true if any node is a symlink, which hdf_copy would flatten to text
+static bool HasSymlink( HDF *hdf )
 {
-    NEOERR *nerr = STATUS_OK;
-    char *cache_old = (char*)ne_hash_lookup( fileCache, (void*)cache_id );
+    HDF *node = hdf_obj_child( hdf );
     
-    if( !cache_old )
+    for( ; node; node = hdf_obj_next( node ) )
     {
-        size_t len = strlen( cache_id );
-        char *id = (char*)calloc( len+1, sizeof( char ) );
-        
-        if( !id ){
-            nerr = nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
-        }
-        else
-        {
-            memcpy( id, cache_id, len );
-            if( STATUS_OK != ( nerr = ne_hash_insert( fileCache, (void*)id, (void*)cache ) ) ){
-                free(id);
-            }
+        if( node->link || HasSymlink( node ) ){
+            return true;
         }
     }
     
-    return nerr;
+    return false;
 }
-*/
 
-// parser_id:String createParser( const char *id )
-Handle<Value> ClearSilver::_createParser( Handle<Value> id, ParseCtx_t **context )
+// merge cached tree into dest with the same result as hdf_read_string.
+// hdf_copy keeps the value of an existing top node, so set it first.
+static NEOERR *MergeHDF( HDF *dest, HDF *src )
 {
-    Handle<Value> retval = Undefined();
-    char *estr = NULL;
-    char *parser_id = ( !id->IsString() ) ? NULL : *String::Utf8Value( id );
-    ParseCtx_t *ctx = CreateContext( parser_id, &estr );
+    NEOERR *nerr = STATUS_OK;
+    HDF *node = hdf_obj_child( src );
+    char *name = NULL;
+    char *value = NULL;
     
-    if( !ctx ){
-        retval = ThrowException( Exception::Error( String::New( estr ) ) );
-        free( estr );
-    }
-    // add parse cache
-    else if( ( estr = CHECK_NEOERR( ne_hash_insert( parseCache, (void*)ctx->id, (void*)ctx ) ) ) ){
-        retval = ThrowException( Exception::Error( String::New( estr ) ) );
-        free( estr );
-        DestroyContext( ctx );
-    }
-    else
+    for( ; node && STATUS_OK == nerr; node = hdf_obj_next( node ) )
     {
-        // init parser mutex
-        pthread_mutex_init( &ctx->mutex, NULL );
-        ctx->cs = this;
-        // register fileload hook
-        cs_register_fileload( ctx->csp, (void*)ctx, hookFileload );
-        // return parser_id
-        retval = ( parser_id ) ? id : String::New( ctx->id );
-        if( context ){
-            *context = ctx;
+        name = hdf_obj_name( node );
+        if( !( value = hdf_obj_value( node ) ) ||
+            STATUS_OK == ( nerr = hdf_set_value( dest, name, value ) ) ){
+            nerr = hdf_copy( dest, name, node );
         }
     }
     
-    return retval;
+    return nerr_pass( nerr );
 }
 
-Handle<Value> ClearSilver::createParser( const Arguments &argv )
+// returns valid entry and marks it most recently used
+FileCache_t *ClearSilver::_cacheLookup( const char *path )
 {
-    HandleScope scope;
-    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
-    Handle<Value> retval = Undefined();
-    const int argc = argv.Length();
+    FileCache_t *entry = (FileCache_t*)ne_hash_lookup( fileCache, (void*)path );
     
-    // defined parser_id
-    if( 0 < argc )
+    if( entry )
     {
-        if( argv[0]->IsString() ){
-            retval = cs->_createParser( argv[0], NULL );
+        time_t now = time(NULL);
+        
+        // drop entry if file changed on disk
+        if( now - entry->checked >= (time_t)cacheCheck )
+        {
+            struct stat info;
+            
+            if( 0 != stat( path, &info ) || info.st_mtime != entry->mtime || info.st_size != entry->size ){
+                _cacheRemove( entry );
+                cacheInvalidations++;
+                return NULL;
+            }
+            entry->checked = now;
         }
-        else {
-            retval = ThrowException( Exception::TypeError( String::New( "createParser( [parser_id:String] )" ) ) );
+        // move to head
+        if( entry != lruHead )
+        {
+            entry->prev->next = entry->next;
+            if( entry->next ){
+                entry->next->prev = entry->prev;
+            }
+            else {
+                lruTail = entry->prev;
+            }
+            entry->prev = NULL;
+            entry->next = lruHead;
+            lruHead->prev = entry;
+            lruHead = entry;
         }
-    }
-    // undefined parser_id
-    else {
-        retval = cs->_createParser( Null(), NULL );
+        cacheHits++;
     }
     
-    return scope.Close( retval );
+    return entry;
 }
 
-Handle<Value> ClearSilver::removeParser( const Arguments &argv )
+// parse an .hdf file once and keep the tree with the text; a file with
+// links stays raw and is read on every include
+static NEOERR *LoadTree( FileCache_t *cache )
 {
-    HandleScope scope;
-    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
-    const int argc = argv.Length();
-    Handle<Value> retval = Undefined();
-    ParseCtx_t *ctx = NULL;
+    NEOERR *nerr = STATUS_OK;
+    char *ext = rindex( cache->id, '.' );
     
-    // invalid arguments
-    if( 1 > argc || !argv[0]->IsString() ){
-        retval = ThrowException( Exception::TypeError( String::New( "removeParser( parser_id:String )" ) ) );
-    }
-    // find parser
-    else if( !( ctx = (ParseCtx_t*)ne_hash_remove( cs->parseCache, (void*)*String::Utf8Value( argv[0] ) ) ) ){
-        retval = ThrowException( Exception::ReferenceError( String::New( "faild to removeValue: parser not found" ) ) );
+    if( !ext || strcmp( ext, ".hdf" ) || cache->tree || cache->raw ){
+        // not HDF or done
     }
-    else if( pthread_mutex_lock( &cs->mutex ) ){
-        retval = ThrowException( Exception::ReferenceError( String::New( strerror(errno) ) ) );
-    }
-    else
-    {
-        DestroyContext( ctx );
-        if( pthread_mutex_unlock( &cs->mutex ) ){
-            retval = ThrowException( Exception::ReferenceError( String::New( strerror(errno) ) ) );
-        }
+    else if( STATUS_OK == ( nerr = hdf_init( &cache->tree ) ) &&
+             ( STATUS_OK != ( nerr = hdf_read_string( cache->tree, cache->data ) ) ||
+               ( cache->raw = HasSymlink( cache->tree ) ) ) ){
+        hdf_destroy( &cache->tree );
     }
     
-    return scope.Close( retval );
+    return nerr_pass( nerr );
 }
 
-
-// parseString( template:String, parser_id:String )
-Handle<Value> ClearSilver::parseString( const Arguments &argv )
+// load path into the cache and take a reference to the entry for the
+// caller; call with mutex held. the file is read and parsed with mutex
+// released, and a thread asking for a path being loaded waits for it.
+NEOERR *ClearSilver::_cacheLoad( const char *path, FileCache_t **entry )
 {
-    HandleScope scope;
-    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
-    const int argc = argv.Length();
-    Handle<Value> retval = Null();
-    ParseCtx_t *ctx = NULL;
-    // flag for delete context when failed to parsing
-    bool isTmp = false;
+    NEOERR *nerr = STATUS_OK;
+    FileCache_t *cache = NULL;
+    FileCache_t **ptr = NULL;
+    struct stat info;
     
-    // invalid arguments
-    if( !argv[0]->IsString() ){
-        retval = ThrowException( Exception::TypeError( String::New( "parseString( template:String, [parser_id:String] )" ) ) );
-    }
-    // arguments has parser_id
-    else if( 1 < argc && IsDefined( argv[1] ) )
+    *entry = NULL;
+    while( true )
     {
-        // invalid arguments
-        if( !argv[1]->IsString() ){
-            retval = ThrowException( Exception::TypeError( String::New( "parseString( template:String, [parser_id:String] )" ) ) );
-        }
-        // find parser
-        else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, *String::Utf8Value( argv[1] ) ) ) ){
-            retval = ThrowException( Exception::ReferenceError( String::New( "faild to parseString: parser not found" ) ) );
+        for( cache = loading; cache && strcmp( cache->id, path ); cache = cache->next ){}
+        if( !cache ){
+            break;
         }
-        // already compiled
-        else if( ctx->csp ){
-            retval = argv[1];
+        pthread_cond_wait( &loaded, &mutex );
+        // a failed load is retried by the next one
+        if( ( cache = _cacheLookup( path ) ) ){
+            __sync_add_and_fetch( &cache->refs, 1 );
+            *entry = cache;
+            return STATUS_OK;
         }
     }
-    else
+    
+    cacheMisses++;
+    if( !( cache = (FileCache_t*)calloc( 1, sizeof( FileCache_t ) ) ) ||
+        !( cache->id = strdup( path ) ) ){
+        free( cache );
+        return nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+    }
+    cache->next = loading;
+    loading = cache;
+    pthread_mutex_unlock( &mutex );
+    
+    if( 0 != stat( path, &info ) ){
+        nerr = nerr_raise( ( errno == ENOENT ) ? NERR_NOT_FOUND : NERR_SYSTEM, "%s", strerror(errno) );
+    }
+    // read into the heap; a mapping would fault once the file is
+    // truncated or rewritten in place
+    else if( STATUS_OK == ( nerr = ne_load_file( path, &cache->data ) ) )
     {
-        // create parser
-        Handle<Value> parser_id = cs->_createParser( Null(), &ctx );
-        
-        isTmp = false;
-        // exception
-        if( !parser_id->IsString() ){
-            retval = parser_id;
-        }
+        cache->len = strlen( cache->data );
+        cache->mtime = info.st_mtime;
+        cache->size = info.st_size;
+        nerr = LoadTree( cache );
+    }
+    
+    pthread_mutex_lock( &mutex );
+    for( ptr = &loading; *ptr != cache; ptr = &(*ptr)->next ){}
+    *ptr = cache->next;
+    cache->next = NULL;
+    pthread_cond_broadcast( &loaded );
+    if( STATUS_OK != nerr ||
+        STATUS_OK != ( nerr = ne_hash_insert( fileCache, cache->id, (void*)cache ) ) ){
+        cache->refs = 1;
+        ReleaseFile( cache );
+        return nerr_pass( nerr );
+    }
+    
+    // the cache and the caller
+    cache->refs = 2;
+    *entry = cache;
+    
+    return _cacheLink( cache );
+}
+
+// account inserted entry and link it as most recently used
+NEOERR *ClearSilver::_cacheLink( FileCache_t *cache )
+{
+    // a parsed tree counts as much as its text
+    cache->bytes = ( cache->tree ) ? 2 * cache->len : cache->len;
+    cache->checked = time(NULL);
+    // link to head
+    if( ( cache->next = lruHead ) ){
+        lruHead->prev = cache;
+    }
+    else {
+        lruTail = cache;
+    }
+    lruHead = cache;
+    cacheBytes += cache->bytes;
+    
+    // evict least recently used entries over budget
+    while( cacheMaxBytes && cacheBytes > cacheMaxBytes && lruTail != cache ){
+        _cacheRemove( lruTail );
+        cacheEvictions++;
+    }
+    
+    return STATUS_OK;
+}
+
+void ClearSilver::_cacheRemove( FileCache_t *entry )
+{
+    ne_hash_remove( fileCache, entry->id );
+    if( entry->prev ){
+        entry->prev->next = entry->next;
+    }
+    else {
+        lruHead = entry->next;
+    }
+    if( entry->next ){
+        entry->next->prev = entry->prev;
+    }
+    else {
+        lruTail = entry->prev;
+    }
+    cacheBytes -= entry->bytes;
+    ReleaseFile( entry );
+}
+
+void ClearSilver::_outRemove( OutCache_t *entry )
+{
+    ne_hash_remove( outCache, (void*)entry );
+    if( entry->prev ){
+        entry->prev->next = entry->next;
+    }
+    else {
+        outHead = entry->next;
+    }
+    if( entry->next ){
+        entry->next->prev = entry->prev;
     }
+    else {
+        outTail = entry->prev;
+    }
+    outBytes -= entry->len + entry->canonLen;
+    ReleaseOut( entry );
+}
+
+// reference to the entry cached for key, NULL on a miss; its data is
+// NUL terminated and must not be written. release with ReleaseOut.
+OutCache_t *ClearSilver::_outAcquire( OutCache_t *key )
+{
+    OutCache_t *entry = NULL;
     
-    if( retval->IsNull() )
+    if( pthread_mutex_lock( &outMutex ) ){
+        return NULL;
+    }
+    if( ( entry = (OutCache_t*)ne_hash_lookup( outCache, (void*)key ) ) &&
+        entry->expires && entry->expires <= NowUsec() ){
+        _outRemove( entry );
+        entry = NULL;
+    }
+    if( entry )
     {
-        CSPARSE *csp = NULL;
-        char *tmpl = NULL;
-        size_t len = 0;
-        char *estr = NULL;
-        
-        // copy template string
-        if( -1 == ( len = asprintf( (char**)&tmpl, "%s", *String::Utf8Value( argv[0] ) ) ) ){
-            retval = ThrowException( Exception::Error( String::New( strerror(errno) ) ) );
+        __sync_add_and_fetch( &entry->refs, 1 );
+        outHits++;
+        // move to head
+        if( entry->prev )
+        {
+            entry->prev->next = entry->next;
+            if( entry->next ){
+                entry->next->prev = entry->prev;
+            }
+            else {
+                outTail = entry->prev;
+            }
+            entry->prev = NULL;
+            entry->next = outHead;
+            outHead->prev = entry;
+            outHead = entry;
         }
-        // init csparse and register function
-        else if(( estr = CHECK_NEOERR( cs_init( &csp, ctx->hdf ) ) ) ||
-                ( estr = CHECK_NEOERR( cs_register_strfunc( csp, (char*)"url_escape", cgi_url_escape ) ) ) ||
-                ( estr = CHECK_NEOERR( cs_register_strfunc( csp, (char*)"html_escape", cgi_html_escape_strfunc ) ) ) ||
-                ( estr = CHECK_NEOERR( cs_register_strfunc( csp, (char*)"text_html", cgi_text_html_strfunc ) ) ) ||
-                ( estr = CHECK_NEOERR( cs_register_strfunc( csp, (char*)"js_escape", cgi_js_escape ) ) ) ||
-                ( estr = CHECK_NEOERR( cs_register_strfunc( csp, (char*)"html_strip", cgi_html_strip_strfunc ) ) ) ){
-            retval = ThrowException( Exception::Error( String::New( strerror(errno) ) ) );
-            free(tmpl);
-            cs_destroy(&csp);
+    }
+    else {
+        outMisses++;
+    }
+    pthread_mutex_unlock( &outMutex );
+    
+    return entry;
+}
+
+// copy of the output cached for key, NUL terminated; NULL on a miss
+char *ClearSilver::_outLookup( OutCache_t *key )
+{
+    OutCache_t *entry = _outAcquire( key );
+    char *data = NULL;
+    
+    if( entry ){
+        data = DupBytes( entry->data, entry->len );
+        ReleaseOut( entry );
+    }
+    return data;
+}
+
+// keep page as output of key for ttl usec, 0 until evicted; the page
+// buffer and key->canon are taken over
+void ClearSilver::_outStore( OutCache_t *key, STRING *page, uint64_t ttl )
+{
+    OutCache_t *entry = NULL;
+    OutCache_t *found = NULL;
+    OutCache_t *prev = NULL;
+    NEOERR *nerr = STATUS_OK;
+    uint64_t now = NowUsec();
+    uint32_t i = 0;
+    
+    if( ( outMaxBytes && (size_t)page->len + key->canonLen > outMaxBytes ) ||
+        !( entry = (OutCache_t*)malloc( sizeof( OutCache_t ) ) ) ){
+        string_clear( page );
+        free( key->canon );
+        key->canon = NULL;
+        return;
+    }
+    else if( pthread_mutex_lock( &outMutex ) ){
+        string_clear( page );
+        free( key->canon );
+        key->canon = NULL;
+        free( entry );
+        return;
+    }
+    
+    *entry = *key;
+    entry->data = page->buf;
+    entry->len = page->len;
+    entry->expires = ( ttl ) ? now + ttl : 0;
+    entry->refs = 1;
+    entry->prev = NULL;
+    key->canon = NULL;
+    string_init( page );
+    // expired entries are not looked up again and sink to the tail; drop
+    // them before they push out live ones
+    for( found = outTail; found && i < OUTCACHE_REAP_MAX; found = prev, i++ )
+    {
+        prev = found->prev;
+        if( found->expires && found->expires <= now ){
+            _outRemove( found );
         }
-        // parse
-        else if( ( estr = CHECK_NEOERR( cs_parse_string( csp, tmpl, len ) ) ) ){
-            retval = ThrowException( Exception::Error( String::New( estr ) ) );
-            free(estr);
-            cs_destroy(&csp);
+    }
+    // rendered meanwhile by another thread
+    if( ( found = (OutCache_t*)ne_hash_lookup( outCache, (void*)key ) ) ){
+        _outRemove( found );
+    }
+    if( STATUS_OK != ( nerr = ne_hash_insert( outCache, (void*)entry, (void*)entry ) ) ){
+        nerr_ignore( &nerr );
+        free( entry->canon );
+        free( entry->data );
+        free( entry );
+    }
+    else
+    {
+        entry->next = outHead;
+        if( outHead ){
+            outHead->prev = entry;
         }
-        // success
         else {
-            ctx->csp = csp;
-            retval = String::New( ctx->id );
+            outTail = entry;
         }
-        
-        if( !retval->IsString() && isTmp ){
-            printf("hash_remove: %s\n", ctx->id );
-            ne_hash_remove( cs->parseCache, (void*)ctx->id );
-            DestroyContext( ctx );
+        outHead = entry;
+        outBytes += entry->len + entry->canonLen;
+        while( outMaxBytes && outBytes > outMaxBytes ){
+            _outRemove( outTail );
         }
     }
-    
-    return scope.Close( retval );
+    pthread_mutex_unlock( &outMutex );
 }
 
-#define SetKeyPath(key, parent, parent_len, child, child_len)({ \
-    char *ptr = key; \
-    if( parent_len ){ \
-        memcpy( ptr, parent, parent_len ); \
-        ptr[parent_len] = '.'; \
-        ptr += plen + 1; \
-    } \
-    memcpy( ptr, child, child_len ); \
-    ptr[child_len] = 0; \
-})
-
-inline Handle<Value> ClearSilver::_setValue( HDF *hdf, Local<Object> obj, const char *const parentKey, Local<Array> refs )
+// true if key was resolved within the last check interval; *resolve is
+// a copy of the result, NULL for a path that was not found
+bool ClearSilver::_pathLookup( const char *key, char **resolve )
 {
-    Handle<Value> retval = Undefined();
-    Local<Array> props = obj->GetPropertyNames();
-    uint32_t len = props->Length();
+    PathCache_t *entry = NULL;
+    bool found = false;
     
-    if( len )
+    if( 0 == pthread_mutex_lock( &mutex ) )
     {
-        NEOERR *nerr = STATUS_OK;
-        size_t plen = ( parentKey ) ? strlen( parentKey ) : 0;
-        size_t klen = 0;
-        char *ptr = NULL;
-        Local<Value> key;
-        Local<Value> val;
-        uint32_t valType;
-        char *estr = NULL;
-        
-        for( uint32_t idx = 0; !estr && idx < len; idx++ )
-        {
-            key = props->Get(idx);
-            val = obj->Get(key);
-            klen = key->ToString()->Utf8Length();
-            valType = TypeOf( val );
-            
-            // printf(" idx: %u\n", idx);
-            // printf("type: %s\n", TypeName( val ) );
-            if( valType & isPrintable )
-            {
-                char name[plen+1+klen+1];
-                SetKeyPath( name, parentKey, plen, *String::Utf8Value( key->ToString() ), klen );
-                // Date milliseconds to iso8601
-                if( valType & JS_TYPE_DATE_BIT ){
-                    char iso8601[ISO8601_STRING_LEN];
-                    MSEC_TO_ISO8601(iso8601,val->IntegerValue());
-                    estr = CHECK_NEOERR( hdf_set_value( hdf, name, iso8601 ) );
-                }
-                else if( valType & JS_TYPE_BOOLEAN_BIT ){
-                    estr = CHECK_NEOERR( hdf_set_int_value( hdf, name, ( val->BooleanValue() ) ? 1 : 0 ) );
-                }
-                else {
-                    estr = CHECK_NEOERR( hdf_set_value( hdf, name, *String::Utf8Value( val->ToString() ) ) );
-                }
-            }
-            else if( valType & isRecursive )
-            {
-                // check is circulative object
-                bool isCircular = false;
-                uint32_t nrefs = refs->Length();
-                char name[plen+1+klen+1];
-                
-                SetKeyPath( name, parentKey, plen, *String::Utf8Value( key->ToString() ), klen );
-                for( uint32_t i = 0; i < nrefs; i++ )
-                {
-                    if( ( isCircular = refs->Get(i)->StrictEquals(val) ) ){
-                        estr = CHECK_NEOERR( hdf_set_value( hdf, name, "[Circular]" ) );
-                        break;
-                    }
-                }
-                if( !isCircular )
-                {
-                    refs->Set( nrefs, val );
-                    if( !( retval = _setValue( hdf, val->ToObject(), name, refs ) )->IsUndefined() ){
-                        break;
-                    }
-                }
-            }
-            else if( valType & isRemoval ){
-                char name[plen+1+klen+1];
-                SetKeyPath( name, parentKey, plen, *String::Utf8Value( key->ToString() ), klen );
-                estr = CHECK_NEOERR( hdf_remove_tree( hdf, name ) );
-            }
+        if( ( entry = (PathCache_t*)ne_hash_lookup( pathCache, (void*)key ) ) &&
+            time(NULL) - entry->checked < (time_t)cacheCheck &&
+            ( !entry->path || ( *resolve = strdup( entry->path ) ) ) ){
+            found = true;
+            pathHits++;
         }
-        if( estr ){
-            retval = ThrowException( Exception::Error( String::New( estr ) ) );
-            free(estr);
+        else {
+            pathMisses++;
         }
+        pthread_mutex_unlock( &mutex );
     }
     
-    return retval;
+    return found;
 }
 
-Handle<Value> ClearSilver::setValue( const Arguments& argv )
+void ClearSilver::_pathStore( const char *key, const char *resolve )
+{
+    PathCache_t *entry = NULL;
+    char *path = NULL;
+    NEOERR *nerr = STATUS_OK;
+    
+    if( ( resolve && !( path = strdup( resolve ) ) ) || 0 != pthread_mutex_lock( &mutex ) ){
+        free( path );
+        return;
+    }
+    // refresh
+    if( ( entry = (PathCache_t*)ne_hash_lookup( pathCache, (void*)key ) ) ){
+        free( entry->path );
+        entry->path = path;
+        entry->checked = time(NULL);
+    }
+    else if( ( entry = (PathCache_t*)calloc( 1, sizeof( PathCache_t ) ) ) )
+    {
+        entry->path = path;
+        entry->checked = time(NULL);
+        if( !( entry->id = strdup( key ) ) ||
+            STATUS_OK != ( nerr = ne_hash_insert( pathCache, entry->id, (void*)entry ) ) ){
+            nerr_ignore( &nerr );
+            free( entry->id );
+            free( entry->path );
+            free( entry );
+        }
+    }
+    else {
+        free( path );
+    }
+    pthread_mutex_unlock( &mutex );
+}
+
+// setCacheOptions( options:Object )
+//  options.maxBytes: byte budget of include file cache, 0 is unlimited
+//  options.checkInterval: seconds between mtime checks of cached file
+//  options.outputTTL: ms a rendered output is reused for the same parser,
+//                     template and data; 0 turns the output cache off
+//  options.outputMaxBytes: byte budget of output cache, 0 is unlimited
+//  files read by linclude at render time are not part of the key; a
+//  changed one may be served stale for up to outputTTL.
+Handle<Value> ClearSilver::setCacheOptions( const Arguments &argv )
 {
     HandleScope scope;
     ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
-    Handle<Value> retval = Null();
-    const int argc = argv.Length();
-    ParseCtx_t *ctx = NULL;
+    Handle<Value> retval = Undefined();
+    int rc = 0;
     
     // invalid arguments
-    if( 3 > argc || !argv[0]->IsString() ){
-        retval = ThrowException( Exception::TypeError( String::New( "setValue( parser_id:String, key:[String|Undefined|Null], val:[String|Number|Date|Boolean|Array|Object] )" ) ) );
+    if( 1 > argv.Length() || !argv[0]->IsObject() ){
+        retval = ThrowException( Exception::TypeError( String::New( "setCacheOptions( options:Object )" ) ) );
     }
-    // find parser
-    else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)*String::Utf8Value( argv[0] ) ) ) ){
-        retval = ThrowException( Exception::ReferenceError( String::New( "faild to setValue: parser not found" ) ) );
+    else if( ( rc = pthread_mutex_lock( &cs->mutex ) ) ){
+        retval = ThrowException( Exception::Error( String::New( strerror(rc) ) ) );
     }
     else
     {
-        uint32_t valType = TypeOf( argv[2] );
+        Local<Object> options = argv[0]->ToObject();
+        Local<Value> val = options->Get( String::NewSymbol("maxBytes") );
         
-        if( valType & isPrintable )
+        if( val->IsNumber() && 0 <= val->NumberValue() )
         {
-            char *estr = NULL;
-            
-            if( !argv[1]->IsString() ){
-                retval = ThrowException( Exception::TypeError( String::New( "setValue( parser_id:String, key:String, val:[String|Number|Date|Boolean] )" ) ) );
-            }
-            // Date milliseconds to iso8601
-            else if( valType & JS_TYPE_DATE_BIT ){
-                char iso8601[ISO8601_STRING_LEN];
-                MSEC_TO_ISO8601( iso8601, argv[2]->IntegerValue() );
-                estr = CHECK_NEOERR( hdf_set_value( ctx->hdf, *String::Utf8Value( argv[1] ), iso8601 ) );
+            cs->cacheMaxBytes = (size_t)val->NumberValue();
+            while( cs->cacheMaxBytes && cs->cacheBytes > cs->cacheMaxBytes ){
+                cs->_cacheRemove( cs->lruTail );
+                cs->cacheEvictions++;
             }
-            else if( valType & JS_TYPE_BOOLEAN_BIT ){
-                estr = CHECK_NEOERR( hdf_set_int_value( ctx->hdf, *String::Utf8Value( argv[1] ), ( argv[2]->BooleanValue() ) ? 1 : 0 ) );
+        }
+        val = options->Get( String::NewSymbol("checkInterval") );
+        if( val->IsNumber() && 0 <= val->Int32Value() ){
+            cs->cacheCheck = val->Uint32Value();
+        }
+        pthread_mutex_unlock( &cs->mutex );
+        
+        if( ( rc = pthread_mutex_lock( &cs->outMutex ) ) ){
+            retval = ThrowException( Exception::Error( String::New( strerror(rc) ) ) );
+        }
+        else
+        {
+            val = options->Get( String::NewSymbol("outputTTL") );
+            if( val->IsNumber() && 0 <= val->NumberValue() ){
+                cs->outTTL = (uint64_t)( val->NumberValue() * 1000 );
             }
-            else {
-                estr = CHECK_NEOERR( hdf_set_value( ctx->hdf, *String::Utf8Value( argv[1] ), *String::Utf8Value( argv[2] ) ) );
+            val = options->Get( String::NewSymbol("outputMaxBytes") );
+            if( val->IsNumber() && 0 <= val->NumberValue() ){
+                cs->outMaxBytes = (size_t)val->NumberValue();
             }
-            
-            if( estr ){
-                retval = ThrowException( Exception::Error( String::New( estr ) ) );
-                free(estr);
+            while( cs->outTail && ( !cs->outTTL || ( cs->outMaxBytes && cs->outBytes > cs->outMaxBytes ) ) ){
+                cs->_outRemove( cs->outTail );
             }
-        }
-        else if( valType & isRecursive )
-        {
-            Local<Object> obj = argv[2]->ToObject();
-            Local<Array> refs = Array::New();
-            
-            // set root object
-            refs->Set( 0, obj );
-            retval = _setValue( ctx->hdf, obj, ( !argv[1]->IsString() ) ? "" : *String::Utf8Value( argv[1] ), refs );
+            pthread_mutex_unlock( &cs->outMutex );
         }
     }
     
-    return scope.Close( retval->IsNull() ? Handle<Value>() : retval );
+    return scope.Close( retval );
 }
 
-Handle<Value> ClearSilver::getValue( const Arguments &argv )
+// setRenderPool( options:Object )
+//  options.threads: render workers shared by all instances, defaults to
+//  the number of cores. async renders run there instead of the libeio
+//  pool, which keeps serving fs and template compiles.
+//  options.maxQueue: async renders queued but not started before render
+//  throws EQUEUEFULL, 0 is unlimited
+Handle<Value> ClearSilver::setRenderPool( const Arguments &argv )
 {
     HandleScope scope;
-    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
-    const int argc = argv.Length();
     Handle<Value> retval = Undefined();
-    ParseCtx_t *ctx = NULL;
+    Local<Value> threads;
+    Local<Value> maxQueue;
+    int rc = 0;
+    
+    if( 0 < argv.Length() && argv[0]->IsObject() ){
+        threads = argv[0]->ToObject()->Get( String::NewSymbol("threads") );
+        maxQueue = argv[0]->ToObject()->Get( String::NewSymbol("maxQueue") );
+    }
     
     // invalid arguments
-    if( 2 > argc || !argv[0]->IsString() || !argv[1]->IsString() ){
-        retval = ThrowException( Exception::TypeError( String::New( "removeValue( parser_id:String, key:String )" ) ) );
+    if( threads.IsEmpty() ||
+        !( threads->IsUndefined() || ( threads->IsNumber() && 0 < threads->NumberValue() && RENDER_POOL_MAX >= threads->NumberValue() ) ) ||
+        !( maxQueue->IsUndefined() || ( maxQueue->IsNumber() && 0 <= maxQueue->NumberValue() ) ) ){
+        retval = ThrowException( Exception::TypeError( String::New( "setRenderPool( options:Object )" ) ) );
     }
-    // find parser
-    else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)*String::Utf8Value( argv[0] ) ) ) ){
-        retval = ThrowException( Exception::ReferenceError( String::New( "faild to removeValue: parser not found" ) ) );
+    else if( threads->IsNumber() && ( rc = RenderPoolResize( threads->Uint32Value() ) ) ){
+        retval = ThrowException( Exception::Error( String::New( strerror(rc) ) ) );
     }
-    else
-    {
-        char *val = hdf_get_value( ctx->hdf, *String::Utf8Value( argv[1] ), NULL );
-        if( val ){
-            retval = String::New( val );
-        }
+    else if( maxQueue->IsNumber() ){
+        RenderPool.maxQueue = maxQueue->Uint32Value();
     }
     
     return scope.Close( retval );
 }
 
-Handle<Value> ClearSilver::removeValue( const Arguments &argv )
+// renderPoolStats(): { threads, depth, waiting, maxQueue, rejected, expired,
+//                      jobs, waitTime, waitTimeMax }
+//  depth: renders queued for a worker, waiting: renders queued for a free
+//  replica of their parser; times in microseconds.
+Handle<Value> ClearSilver::renderPoolStats( const Arguments &argv )
+{
+    HandleScope scope;
+    Local<Object> stats = Object::New();
+    RenderPool_t *pool = &RenderPool;
+    
+    (void)argv;
+    stats->Set( String::NewSymbol("threads"), Number::New( pool->size ) );
+    stats->Set( String::NewSymbol("depth"), Number::New( pool->pending ) );
+    stats->Set( String::NewSymbol("waiting"), Number::New( pool->waiting ) );
+    stats->Set( String::NewSymbol("maxQueue"), Number::New( pool->maxQueue ) );
+    stats->Set( String::NewSymbol("rejected"), Number::New( pool->rejected ) );
+    stats->Set( String::NewSymbol("expired"), Number::New( pool->expired ) );
+    stats->Set( String::NewSymbol("jobs"), Number::New( pool->jobs ) );
+    stats->Set( String::NewSymbol("waitTime"), Number::New( pool->waitTime ) );
+    stats->Set( String::NewSymbol("waitTimeMax"), Number::New( pool->waitTimeMax ) );
+    
+    return scope.Close( stats );
+}
+
+// cacheStats(): { hits, misses, evictions, invalidations, entries, bytes, maxBytes,
+//                resolveHits, resolveMisses, outputHits, outputMisses,
+//                outputEntries, outputBytes, outputUncacheable }
+//  outputUncacheable counts fragment renders whose output held "<?cs".
+Handle<Value> ClearSilver::cacheStats( const Arguments &argv )
 {
     HandleScope scope;
     ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
-    const int argc = argv.Length();
     Handle<Value> retval = Undefined();
-    ParseCtx_t *ctx = NULL;
+    int rc = 0;
     
-    // invalid arguments
-    if( 2 > argc || !argv[0]->IsString() || !argv[1]->IsString() ){
-        retval = ThrowException( Exception::TypeError( String::New( "removeValue( parser_id:String, key:String )" ) ) );
-    }
-    // find parser
-    else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)*String::Utf8Value( argv[0] ) ) ) ){
-        retval = ThrowException( Exception::ReferenceError( String::New( "faild to removeValue: parser not found" ) ) );
+    if( ( rc = pthread_mutex_lock( &cs->mutex ) ) ){
+        retval = ThrowException( Exception::Error( String::New( strerror(rc) ) ) );
     }
     else
     {
-        char *estr = NULL;
+        Local<Object> stats = Object::New();
         
-        if( ( estr = CHECK_NEOERR( hdf_remove_tree( ctx->hdf, *String::Utf8Value( argv[1] ) ) ) ) ){
-            retval = ThrowException( Exception::ReferenceError( String::New( estr ) ) );
-            free(estr);
+        stats->Set( String::NewSymbol("hits"), Number::New( cs->cacheHits ) );
+        stats->Set( String::NewSymbol("misses"), Number::New( cs->cacheMisses ) );
+        stats->Set( String::NewSymbol("evictions"), Number::New( cs->cacheEvictions ) );
+        stats->Set( String::NewSymbol("invalidations"), Number::New( cs->cacheInvalidations ) );
+        stats->Set( String::NewSymbol("entries"), Number::New( cs->fileCache->num ) );
+        stats->Set( String::NewSymbol("bytes"), Number::New( cs->cacheBytes ) );
+        stats->Set( String::NewSymbol("maxBytes"), Number::New( cs->cacheMaxBytes ) );
+        stats->Set( String::NewSymbol("resolveHits"), Number::New( cs->pathHits ) );
+        stats->Set( String::NewSymbol("resolveMisses"), Number::New( cs->pathMisses ) );
+        pthread_mutex_unlock( &cs->mutex );
+        if( 0 == pthread_mutex_lock( &cs->outMutex ) )
+        {
+            stats->Set( String::NewSymbol("outputHits"), Number::New( cs->outHits ) );
+            stats->Set( String::NewSymbol("outputMisses"), Number::New( cs->outMisses ) );
+            stats->Set( String::NewSymbol("outputEntries"), Number::New( cs->outCache->num ) );
+            stats->Set( String::NewSymbol("outputBytes"), Number::New( cs->outBytes ) );
+            stats->Set( String::NewSymbol("outputUncacheable"), Number::New( cs->outUncacheable ) );
+            pthread_mutex_unlock( &cs->outMutex );
         }
+        retval = stats;
     }
     
     return scope.Close( retval );
 }
 
-Handle<Value> ClearSilver::dump( const Arguments &argv )
+// cacheFragment( path:String, keys:[Array|Null], [options:Object] )
+//  caches the rendered output of the file at path where a template
+//  includes it with linclude, per values of the HDF paths in keys
+//  (with their subtrees). the output is reused across renders and
+//  parsers until one of those values, the file or a file it includes
+//  changes; keys null drops the declaration. a miss renders the file on
+//  a parser of its own with the HDF of the including render, but without
+//  its locals: a fragment must not read each/loop variables or macro
+//  arguments of the including template, only HDF paths. outputs holding
+//  "<?cs" are not cached and counted in cacheStats.
+//  options.ttl: ms an output is kept, 0 (default) until evicted
+//  fragments share budget and stats of the output cache.
+Handle<Value> ClearSilver::cacheFragment( const Arguments &argv )
 {
     HandleScope scope;
     ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
     const int argc = argv.Length();
     Handle<Value> retval = Undefined();
-    ParseCtx_t *ctx = NULL;
+    Fragment_t *frag = NULL;
+    Local<Value> ttl;
+    char resolve[PATH_MAX];
+    char *estr = NULL;
+    uint32_t i = 0;
+    int rc = 0;
+    
+    if( 2 < argc && argv[2]->IsObject() ){
+        ttl = argv[2]->ToObject()->Get( String::NewSymbol("ttl") );
+    }
     
     // invalid arguments
-    if( !argv[0]->IsString() ){
-        retval = ThrowException( Exception::TypeError( String::New( "dump( parser_id:String )" ) ) );
+    if( 2 > argc || !argv[0]->IsString() || !( argv[1]->IsArray() || argv[1]->IsNull() ) ||
+        ( 2 < argc && IsDefined( argv[2] ) && ttl.IsEmpty() ) ||
+        ( !ttl.IsEmpty() && !ttl->IsUndefined() && !( ttl->IsNumber() && 0 <= ttl->NumberValue() ) ) ){
+        return ThrowException( Exception::TypeError( String::New( "cacheFragment( path:String, keys:[Array|Null], [options:Object] )" ) ) );
     }
-    // find parser
-    else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)*String::Utf8Value( argv[0] ) ) ) ){
-        retval = ThrowException( Exception::ReferenceError( String::New( "faild to dump: parser not found" ) ) );
+    else if( !realpath( *String::Utf8Value( argv[0] ), resolve ) ){
+        char msg[PATH_MAX + 64];
+        snprintf( msg, sizeof(msg), "faild to cacheFragment: %s", strerror(errno) );
+        return ThrowException( Exception::ReferenceError( String::New( msg ) ) );
+    }
+    
+    if( argv[1]->IsArray() )
+    {
+        Local<Array> keys = Local<Array>::Cast( argv[1] );
+        
+        if( !( frag = (Fragment_t*)calloc( 1, sizeof( Fragment_t ) ) ) ||
+            !( frag->id = strdup( resolve ) ) ||
+            ( keys->Length() && !( frag->keys = (char**)calloc( keys->Length(), sizeof( char* ) ) ) ) )
+        {
+            if( frag ){
+                DestroyFragment( frag );
+            }
+            return ThrowException( Exception::Error( String::New( strerror(errno) ) ) );
+        }
+        for( i = 0; i < keys->Length(); i++ )
+        {
+            Local<Value> key = keys->Get( i );
+            
+            if( !key->IsString() ){
+                DestroyFragment( frag );
+                return ThrowException( Exception::TypeError( String::New( "cacheFragment: keys must be HDF path strings" ) ) );
+            }
+            else if( !( frag->keys[i] = strdup( *String::Utf8Value( key ) ) ) ){
+                DestroyFragment( frag );
+                return ThrowException( Exception::Error( String::New( strerror(errno) ) ) );
+            }
+            frag->nkeys++;
+        }
+        frag->ttl = ( !ttl.IsEmpty() && ttl->IsNumber() ) ? (uint64_t)( ttl->NumberValue() * 1000 ) : 0;
+        frag->serial = ++FragmentSerial;
+    }
+    
+    // replace declaration
+    if( ( rc = pthread_mutex_lock( &cs->mutex ) ) ){
+        retval = ThrowException( Exception::Error( String::New( strerror(rc) ) ) );
+        if( frag ){
+            DestroyFragment( frag );
+        }
     }
     else
     {
-        char *estr = NULL;
-        STRING dump;
+        Fragment_t *old = (Fragment_t*)ne_hash_remove( cs->fragments, (void*)resolve );
         
-        string_init(&dump);
-        if( ( estr = CHECK_NEOERR( hdf_dump_str(ctx->hdf, NULL, 2, &dump) ) ) ){
-            retval = ThrowException( Exception::ReferenceError( String::New( estr ) ) );
-            free(estr);
+        if( old ){
+            DestroyFragment( old );
         }
-        else {
-            retval = String::New( dump.buf );
+        if( frag && ( estr = CHECK_NEOERR( ne_hash_insert( cs->fragments, (void*)frag->id, (void*)frag ) ) ) ){
+            retval = ThrowException( Exception::Error( String::New( estr ) ) );
+            free( estr );
+            DestroyFragment( frag );
         }
-        string_clear(&dump);
+        pthread_mutex_unlock( &cs->mutex );
     }
     
     return scope.Close( retval );
 }
 
-
-Handle<Value> ClearSilver::render( const Arguments &argv )
+// parser_id:String createParser( const char *id )
+Handle<Value> ClearSilver::_createParser( Handle<Value> id, ParseCtx_t **context )
 {
-    HandleScope scope;
-    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
-    const int argc = argv.Length();
     Handle<Value> retval = Undefined();
-    ParseCtx_t *ctx = NULL;
-    bool callback = false;
-    
+    char *estr = NULL;
+    String::Utf8Value str( id );
+    char *parser_id = ( !id->IsString() ) ? NULL : *str;
+    ParseCtx_t *ctx = CreateContext( parser_id, &estr );
+    
+    if( !ctx ){
+        retval = ThrowException( Exception::Error( String::New( estr ) ) );
+        free( estr );
+    }
+    // add parse cache
+    else if( ( estr = CHECK_NEOERR( ne_hash_insert( parseCache, (void*)ctx->id, (void*)ctx ) ) ) ){
+        retval = ThrowException( Exception::Error( String::New( estr ) ) );
+        free( estr );
+        DestroyContext( ctx );
+    }
+    else
+    {
+        ctx->cs = this;
+        // return parser_id
+        retval = ( parser_id ) ? id : String::New( ctx->id );
+        if( context ){
+            *context = ctx;
+        }
+    }
+    
+    return retval;
+}
+
+// createParser( [parser_id:String], [options:Object] )
+//  options.pool: max number of concurrent render replicas
+//  options.poolIdle: seconds an unused replica is kept
+Handle<Value> ClearSilver::createParser( const Arguments &argv )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    Handle<Value> retval = Undefined();
+    const int argc = argv.Length();
+    ParseCtx_t *ctx = NULL;
+    int id = ( 0 < argc && argv[0]->IsString() ) ? 0 : -1;
+    int opts = ( id + 1 < argc && argv[id+1]->IsObject() ) ? id + 1 : -1;
+    
+    // invalid arguments
+    if( ( 0 < argc && id == -1 && opts == -1 ) || ( 1 < argc && opts == -1 && IsDefined( argv[1] ) ) ){
+        retval = ThrowException( Exception::TypeError( String::New( "createParser( [parser_id:String], [options:Object] )" ) ) );
+    }
+    else if( ( retval = cs->_createParser( ( id == -1 ) ? Null() : argv[id], &ctx ) )->IsString() && opts != -1 )
+    {
+        Local<Object> options = argv[opts]->ToObject();
+        Local<Value> val = options->Get( String::NewSymbol("pool") );
+        
+        if( val->IsNumber() && 0 < val->Int32Value() ){
+            ctx->poolMax = val->Uint32Value();
+        }
+        val = options->Get( String::NewSymbol("poolIdle") );
+        if( val->IsNumber() && 0 <= val->Int32Value() ){
+            ctx->poolIdle = val->Uint32Value();
+        }
+    }
+    
+    return scope.Close( retval );
+}
+
+Handle<Value> ClearSilver::removeParser( const Arguments &argv )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    const int argc = argv.Length();
+    Handle<Value> retval = Undefined();
+    ParseCtx_t *ctx = NULL;
+    
     // invalid arguments
-    if( !argv[0]->IsString() || ( 1 < argc && !( callback = argv[1]->IsFunction() ) ) ){
-        retval = ThrowException( Exception::TypeError( String::New( "render( parser_id:String, [callback:Function] )" ) ) );
+    if( 1 > argc || !argv[0]->IsString() ){
+        retval = ThrowException( Exception::TypeError( String::New( "removeParser( parser_id:String )" ) ) );
     }
     // find parser
     else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)*String::Utf8Value( argv[0] ) ) ) ){
-        retval = ThrowException( Exception::ReferenceError( String::New( "faild to render: parser not found" ) ) );
+        retval = ThrowException( Exception::ReferenceError( String::New( "faild to removeValue: parser not found" ) ) );
     }
-    else if( !ctx->csp ){
-        retval = ThrowException( Exception::ReferenceError( String::New( "faild to render: parser_id does not parsed" ) ) );
+    else if( !ne_hash_remove( cs->parseCache, (void*)ctx->id ) ){
+        retval = ThrowException( Exception::ReferenceError( String::New( "faild to removeValue: parser not found" ) ) );
+    }
+    else if( pthread_mutex_lock( &cs->mutex ) ){
+        retval = ThrowException( Exception::ReferenceError( String::New( strerror(errno) ) ) );
     }
-    // render async
-    else if( callback )
+    else
     {
-        Baton_t *baton = new Baton_t();
-        baton->ctx = (void*)ctx;
-        baton->data = NULL;
-        // detouch from GC
-        baton->callback = Persistent<Function>::New( Local<Function>::Cast( argv[1] ) );
-        cs->Ref();
-        baton->req = eio_custom( renderBeginEIO, EIO_PRI_DEFAULT, renderEndEIO, baton );
-        ev_ref(EV_DEFAULT_UC);
+        // in-flight renders and compiles keep their own reference
+        ReleaseContext( ctx );
+        if( pthread_mutex_unlock( &cs->mutex ) ){
+            retval = ThrowException( Exception::ReferenceError( String::New( strerror(errno) ) ) );
+        }
+    }
+    
+    return scope.Close( retval );
+}
+
+
+// string functions of every template
+static inline NEOERR *RegisterFunctions( CSPARSE *csp )
+{
+    NEOERR *nerr = STATUS_OK;
+    
+    if( STATUS_OK != ( nerr = cs_register_strfunc( csp, (char*)"url_escape", cgi_url_escape ) ) ||
+        STATUS_OK != ( nerr = cs_register_strfunc( csp, (char*)"html_escape", cgi_html_escape_strfunc ) ) ||
+        STATUS_OK != ( nerr = cs_register_strfunc( csp, (char*)"text_html", cgi_text_html_strfunc ) ) ||
+        STATUS_OK != ( nerr = cs_register_strfunc( csp, (char*)"js_escape", cgi_js_escape ) ) ||
+        STATUS_OK != ( nerr = cs_register_strfunc( csp, (char*)"html_strip", cgi_html_strip_strfunc ) ) ){
+        return nerr_pass( nerr );
+    }
+    return STATUS_OK;
+}
+
+// HDF a compile or render on this thread reads in place of the parser
+// HDF: the Config snapshot of a compile, the frozen copy of a render
+static __thread HDF *ParserHDF = NULL;
+
+// compile src into a new CSPARSE bound to ctx. hdf is read for Config and
+// takes HDF files included at parse time: the parser HDF, or a snapshot
+// of its Config when compiling without ctx->lock.
+NEOERR *ClearSilver::_compile( ParseCtx_t *ctx, HDF *hdf, const char *src, size_t len, Tree_t **tree )
+{
+    NEOERR *nerr = STATUS_OK;
+    char *tmpl = (char*)malloc( len + 1 );
+    uint64_t start = NowUsec();
+    CSPARSE *parse = NULL;
+    CSPARSE **csp = &parse;
+    
+    *tree = NULL;
+    if( !tmpl ){
+        return nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+    }
+    // copy template string
+    memcpy( tmpl, src, len );
+    tmpl[len] = 0;
+    
+    // init csparse and register function
+    if( STATUS_OK != ( nerr = cs_init( csp, hdf ) ) ||
+        STATUS_OK != ( nerr = RegisterFunctions( *csp ) ) ){
+        free( tmpl );
+    }
+    else {
+        // register fileload hook
+        cs_register_fileload( *csp, (void*)ctx, hookFileload );
+        // parse; csparse takes over tmpl
+        ParserHDF = hdf;
+        nerr = cs_parse_string( *csp, tmpl, len );
+        ParserHDF = NULL;
+        // .hdf includes may have written the parser HDF
+        if( hdf == ctx->hdf ){
+            ctx->version++;
+        }
+    }
+    
+    if( STATUS_OK != nerr ){
+        if( *csp ){
+            cs_destroy( csp );
+        }
+    }
+    else if( !( *tree = (Tree_t*)calloc( 1, sizeof( Tree_t ) ) ) ){
+        nerr = nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+        cs_destroy( csp );
+    }
+    else {
+        // renders without data read the parser HDF
+        parse->hdf = ctx->hdf;
+        (*tree)->csp = parse;
+        (*tree)->refs = 1;
+    }
+    
+    start = NowUsec() - start;
+    ctx->stats.parseTimeLast = start;
+    __sync_add_and_fetch( &ctx->stats.parses, 1 );
+    __sync_add_and_fetch( &ctx->stats.parseTime, start );
+    
+    return nerr_pass( nerr );
+}
+
+// keep template source for snapshots
+static inline bool SetSource( ParseCtx_t *ctx, const char *src, size_t len )
+{
+    char *copy = DupBytes( src, len );
+    
+    if( !copy ){
+        return false;
+    }
+    free( ctx->src );
+    ctx->src = copy;
+    ctx->srclen = len;
+    
+    return true;
+}
+
+// copy of the parser Config to compile on without ctx->lock
+static inline NEOERR *SnapshotConfig( ParseCtx_t *ctx, HDF **hdf )
+{
+    NEOERR *nerr = hdf_init( hdf );
+    HDF *config = hdf_get_obj( ctx->hdf, "Config" );
+    
+    if( STATUS_OK == nerr && config && STATUS_OK != ( nerr = hdf_copy( *hdf, "Config", config ) ) ){
+        hdf_destroy( hdf );
+    }
+    return nerr_pass( nerr );
+}
+
+// HDF files included at parse time went into the snapshot; merge them
+// into the parser as a compile on the parser HDF would have
+static NEOERR *MergeSnapshot( ParseCtx_t *ctx, HDF *hdf )
+{
+    NEOERR *nerr = STATUS_OK;
+    int rc = 0;
+    
+    if( STATUS_OK != ( nerr = hdf_remove_tree( hdf, "Config" ) ) || !hdf_obj_child( hdf ) ){
+        return nerr_pass( nerr );
+    }
+    else if( ( rc = pthread_rwlock_wrlock( &ctx->lock ) ) ){
+        return nerr_raise( NERR_LOCK, "Lock failed: %s", strerror(rc) );
+    }
+    if( ctx->prints ){
+        hdf_destroy( &ctx->prints );
+    }
+    ctx->version++;
+    nerr = MergeHDF( ctx->hdf, hdf );
+    pthread_rwlock_unlock( &ctx->lock );
+    
+    return nerr_pass( nerr );
+}
+
+// swap in the tree of compile seq; renders in flight keep the old one
+// until done. a compile older than the installed tree is dropped.
+static inline bool InstallTree( ParseCtx_t *ctx, Tree_t *tree, uint32_t seq )
+{
+    Tree_t *old = NULL;
+    
+    if( (int32_t)( seq - ctx->treeInstalled ) < 0 ){
+        ReleaseTree( tree );
+        return false;
+    }
+    ctx->treeInstalled = seq;
+    tree->seq = seq;
+    pthread_mutex_lock( &ctx->treeLock );
+    old = ctx->tree;
+    ctx->tree = tree;
+    pthread_mutex_unlock( &ctx->treeLock );
+    ReleaseTree( old );
+    
+    return true;
+}
+
+// parseString( template:String, [parser_id:String], [callback:Function] )
+//  with callback the template is compiled on a worker thread and
+//  callback( err, parser_id ) is called on completion. the compile sees
+//  the parser Config as of the call; HDF files it includes are merged
+//  into the parser on completion.
+Handle<Value> ClearSilver::parseString( const Arguments &argv )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    const int argc = argv.Length();
+    Handle<Value> retval = Null();
+    ParseCtx_t *ctx = NULL;
+    int callback = ( 1 < argc && argv[argc-1]->IsFunction() ) ? argc - 1 : 0;
+    // flag for delete context when failed to parsing
+    bool isTmp = false;
+    // already compiled
+    bool compiled = false;
+    
+    // invalid arguments
+    if( 1 > argc || !argv[0]->IsString() || ( 2 < argc && !callback ) ){
+        retval = ThrowException( Exception::TypeError( String::New( "parseString( template:String, [parser_id:String], [callback:Function] )" ) ) );
+    }
+    // arguments has parser_id
+    else if( 1 < argc && callback != 1 && IsDefined( argv[1] ) )
+    {
+        // invalid arguments
+        if( !argv[1]->IsString() ){
+            retval = ThrowException( Exception::TypeError( String::New( "parseString( template:String, [parser_id:String], [callback:Function] )" ) ) );
+        }
+        // find parser
+        else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, *String::Utf8Value( argv[1] ) ) ) ){
+            retval = ThrowException( Exception::ReferenceError( String::New( "faild to parseString: parser not found" ) ) );
+        }
+        // already compiled
+        else if( ctx->tree )
+        {
+            compiled = true;
+            // compiled from snapshot: keep it only if the source matches
+            if( ctx->snapshot )
+            {
+                String::Utf8Value tmpl( argv[0] );
+                
+                ctx->snapshot = false;
+                compiled = ( (size_t)tmpl.length() == ctx->srclen && !memcmp( *tmpl, ctx->src, ctx->srclen ) );
+            }
+        }
     }
-    // parse sync
     else
     {
+        // create parser
+        Handle<Value> parser_id = cs->_createParser( Null(), &ctx );
+        
+        isTmp = true;
+        // exception
+        if( !parser_id->IsString() ){
+            retval = parser_id;
+        }
+    }
+    
+    // compile async
+    if( retval->IsNull() && callback )
+    {
+        Baton_t *baton = new Baton_t();
+        String::Utf8Value tmpl( argv[0] );
         char *estr = NULL;
-        STRING page;
         
-        string_init(&page);
+        baton->ctx = (void*)ctx;
+        baton->isTmp = isTmp;
+        // copy template string; kept as parser source on success
+        if( !compiled && ( !( baton->data = (void*)DupBytes( *tmpl, tmpl.length() ) ) ||
+                           ( estr = CHECK_NEOERR( SnapshotConfig( ctx, &baton->hdf ) ) ) ) )
+        {
+            retval = ThrowException( Exception::Error( String::New( ( estr ) ? estr : strerror(errno) ) ) );
+            free( estr );
+            free( baton->data );
+            delete baton;
+            if( isTmp ){
+                ne_hash_remove( cs->parseCache, (void*)ctx->id );
+                ReleaseContext( ctx );
+            }
+        }
+        else
+        {
+            baton->len = tmpl.length();
+            // detouch from GC
+            baton->callback = Persistent<Function>::New( Local<Function>::Cast( argv[callback] ) );
+            RetainContext( ctx );
+            baton->seq = ++ctx->treeSeq;
+            cs->Ref();
+            ev_ref(EV_DEFAULT_UC);
+            eio_custom( parseStringBeginEIO, EIO_PRI_DEFAULT, parseStringEndEIO, baton );
+            retval = Undefined();
+        }
+    }
+    else if( retval->IsNull() && compiled ){
+        retval = String::New( ctx->id );
+    }
+    // compile sync
+    else if( retval->IsNull() )
+    {
+        String::Utf8Value tmpl( argv[0] );
+        Tree_t *tree = NULL;
+        HDF *hdf = NULL;
+        char *estr = NULL;
         
-        // render
-        if( ( estr = CHECK_NEOERR( cs_render( ctx->csp, &page, callbackRender ) ) ) ){
+        // parse on a copy of Config as the async compile does; renders on
+        // other threads read the parser hdf meanwhile, and .hdf includes
+        // are merged into it under the write lock
+        if( ( estr = CHECK_NEOERR( SnapshotConfig( ctx, &hdf ) ) ) ||
+            ( estr = CHECK_NEOERR( _compile( ctx, hdf, *tmpl, tmpl.length(), &tree ) ) ) ||
+            ( estr = CHECK_NEOERR( MergeSnapshot( ctx, hdf ) ) ) ){
             retval = ThrowException( Exception::Error( String::New( estr ) ) );
             free(estr);
+            ReleaseTree( tree );
+        }
+        else if( !SetSource( ctx, *tmpl, tmpl.length() ) ){
+            retval = ThrowException( Exception::Error( String::New( strerror(errno) ) ) );
+            ReleaseTree( tree );
         }
+        // success
         else {
-            retval = String::New( page.buf );
+            InstallTree( ctx, tree, ++ctx->treeSeq );
+            retval = String::New( ctx->id );
+        }
+        
+        if( hdf ){
+            hdf_destroy( &hdf );
+        }
+        if( !retval->IsString() && isTmp ){
+            ne_hash_remove( cs->parseCache, (void*)ctx->id );
+            ReleaseContext( ctx );
         }
-        string_clear(&page);
     }
     
     return scope.Close( retval );
 }
 
+int ClearSilver::parseStringBeginEIO( eio_req *req )
+{
+    Baton_t *baton = static_cast<Baton_t*>( req->data );
+    ParseCtx_t *ctx = (ParseCtx_t*)baton->ctx;
+    
+    // parser hdf may be written by setValue meanwhile; the compile runs
+    // on a copy of its Config instead of locking writers out
+    if( baton->data ){
+        baton->nerr = _compile( ctx, baton->hdf, (const char*)baton->data, baton->len, &baton->tree );
+    }
+    
+    return 0;
+}
+
+int ClearSilver::parseStringEndEIO( eio_req *req )
+{
+    HandleScope scope;
+    Baton_t *baton = static_cast<Baton_t*>(req->data);
+    ParseCtx_t *ctx = (ParseCtx_t*)baton->ctx;
+    ClearSilver *cs = ctx->cs;
+    Handle<Primitive> t = Undefined();
+    Local<Value> argv[] = {
+        reinterpret_cast<Local<Value>&>(t),
+        reinterpret_cast<Local<Value>&>(t)
+    };
+    
+    ev_unref(EV_DEFAULT_UC);
+    
+    if( STATUS_OK == baton->nerr && baton->tree &&
+        STATUS_OK != ( baton->nerr = MergeSnapshot( ctx, baton->hdf ) ) ){
+        ReleaseTree( baton->tree );
+        baton->tree = NULL;
+    }
+    if( baton->hdf ){
+        hdf_destroy( &baton->hdf );
+    }
+    
+    if( STATUS_OK != baton->nerr )
+    {
+        const char *errstr = CHECK_NEOERR( baton->nerr );
+        baton->nerr = STATUS_OK;
+        argv[0] = Exception::Error( String::New( errstr ) );
+        free( (void*)errstr );
+        free( baton->data );
+        if( baton->isTmp && ctx == ne_hash_lookup( cs->parseCache, (void*)ctx->id ) ){
+            ne_hash_remove( cs->parseCache, (void*)ctx->id );
+            ReleaseContext( ctx );
+        }
+    }
+    else
+    {
+        argv[1] = String::New( ctx->id );
+        if( baton->tree && InstallTree( ctx, baton->tree, baton->seq ) ){
+            free( ctx->src );
+            ctx->src = (char*)baton->data;
+            ctx->srclen = baton->len;
+            // no longer the tree compiled from snapshot
+            ctx->snapshot = false;
+        }
+        // superseded by a later compile
+        else {
+            free( baton->data );
+        }
+    }
+    ReleaseContext( ctx );
+    cs->Unref();
+    
+    TryCatch try_catch;
+    // call js function by callback function context
+    baton->callback->Call( baton->callback, 2, argv );
+    if( try_catch.HasCaught() ){
+        FatalException(try_catch);
+    }
+    // remove callback
+    baton->callback.Dispose();
+    delete baton;
+    
+    eio_cancel(req);
+    
+    return 0;
+}
+
+// replaceTemplate( parser_id:String, template:String, callback:Function )
+//  compiles template on a worker thread and swaps it into the parser;
+//  the parser stays available meanwhile and renders in flight finish on
+//  the old tree. callback( err, parser_id ) is called on completion.
+Handle<Value> ClearSilver::replaceTemplate( const Arguments &argv )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    Handle<Value> retval = Undefined();
+    ParseCtx_t *ctx = NULL;
+    
+    // invalid arguments
+    if( 3 > argv.Length() || !argv[0]->IsString() || !argv[1]->IsString() || !argv[2]->IsFunction() ){
+        retval = ThrowException( Exception::TypeError( String::New( "replaceTemplate( parser_id:String, template:String, callback:Function )" ) ) );
+    }
+    // find parser
+    else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)*String::Utf8Value( argv[0] ) ) ) ){
+        retval = ThrowException( Exception::ReferenceError( String::New( "faild to replaceTemplate: parser not found" ) ) );
+    }
+    else
+    {
+        Baton_t *baton = new Baton_t();
+        String::Utf8Value tmpl( argv[1] );
+        char *estr = NULL;
+        
+        baton->ctx = (void*)ctx;
+        baton->isTmp = false;
+        // copy template string; kept as parser source on success
+        if( !( baton->data = (void*)DupBytes( *tmpl, tmpl.length() ) ) ||
+            ( estr = CHECK_NEOERR( SnapshotConfig( ctx, &baton->hdf ) ) ) ){
+            retval = ThrowException( Exception::Error( String::New( ( estr ) ? estr : strerror(errno) ) ) );
+            free( estr );
+            free( baton->data );
+            delete baton;
+        }
+        else
+        {
+            baton->len = tmpl.length();
+            // detouch from GC
+            baton->callback = Persistent<Function>::New( Local<Function>::Cast( argv[2] ) );
+            RetainContext( ctx );
+            baton->seq = ++ctx->treeSeq;
+            cs->Ref();
+            ev_ref(EV_DEFAULT_UC);
+            eio_custom( parseStringBeginEIO, EIO_PRI_DEFAULT, parseStringEndEIO, baton );
+        }
+    }
+    
+    return scope.Close( retval );
+}
+
+// MARK: snapshot
+// compiled CSTREE is a pointer graph owned by libneo and cannot be written
+// out; a snapshot keeps what a cold start pays for instead: template
+// sources, parser HDF, cached include files and resolved include paths.
+// body records are <uint32 len><bytes>, files also carry mtime and size.
+static inline NEOERR *PutBytes( STRING *str, const void *data, uint32_t len )
+{
+    NEOERR *nerr = string_appendn( str, (const char*)&len, sizeof( uint32_t ) );
+    
+    if( STATUS_OK == nerr && len ){
+        nerr = string_appendn( str, (const char*)data, len );
+    }
+    return nerr_pass( nerr );
+}
+
+static inline NEOERR *PutString( STRING *str, const char *val )
+{
+    return nerr_pass( PutBytes( str, val, ( val ) ? strlen( val ) : 0 ) );
+}
+
+static inline NEOERR *PutInt64( STRING *str, int64_t val )
+{
+    return nerr_pass( string_appendn( str, (const char*)&val, sizeof( int64_t ) ) );
+}
+
+// read a record at *cur; false if it overruns end
+static inline bool GetBytes( const char **cur, const char *end, const char **data, uint32_t *len )
+{
+    if( end - *cur < (ptrdiff_t)sizeof( uint32_t ) ){
+        return false;
+    }
+    memcpy( len, *cur, sizeof( uint32_t ) );
+    *cur += sizeof( uint32_t );
+    if( (size_t)( end - *cur ) < *len ){
+        return false;
+    }
+    *data = *cur;
+    *cur += *len;
+    return true;
+}
+
+static inline bool GetInt64( const char **cur, const char *end, int64_t *val )
+{
+    if( end - *cur < (ptrdiff_t)sizeof( int64_t ) ){
+        return false;
+    }
+    memcpy( val, *cur, sizeof( int64_t ) );
+    *cur += sizeof( int64_t );
+    return true;
+}
+
+static NEOERR *WriteFile( const char *path, STRING *str )
+{
+    NEOERR *nerr = STATUS_OK;
+    char *tmp = NULL;
+    int fd = -1;
+    ssize_t len = 0;
+    int pos = 0;
+    
+    // write aside and rename, so readers never see a partial snapshot
+    if( -1 == asprintf( &tmp, "%s.%d.tmp", path, getpid() ) ){
+        return nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+    }
+    else if( -1 == ( fd = open( tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644 ) ) ){
+        nerr = nerr_raise( NERR_IO, "%s: %s", tmp, strerror(errno) );
+        free( tmp );
+        return nerr;
+    }
+    
+    while( pos < str->len )
+    {
+        if( -1 == ( len = write( fd, str->buf + pos, str->len - pos ) ) )
+        {
+            if( errno != EINTR ){
+                nerr = nerr_raise( NERR_IO, "%s: %s", tmp, strerror(errno) );
+                break;
+            }
+        }
+        else {
+            pos += len;
+        }
+    }
+    if( 0 != close( fd ) && STATUS_OK == nerr ){
+        nerr = nerr_raise( NERR_IO, "%s: %s", tmp, strerror(errno) );
+    }
+    if( STATUS_OK == nerr && 0 != rename( tmp, path ) ){
+        nerr = nerr_raise( NERR_IO, "%s: %s", path, strerror(errno) );
+    }
+    if( STATUS_OK != nerr ){
+        unlink( tmp );
+    }
+    free( tmp );
+    
+    return nerr;
+}
+
+// saveSnapshot( path:String )
+Handle<Value> ClearSilver::saveSnapshot( const Arguments &argv )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    Handle<Value> retval = Undefined();
+    NEOERR *nerr = STATUS_OK;
+    SnapshotHeader_t head;
+    STRING str;
+    char *estr = NULL;
+    int rc = 0;
+    
+    // invalid arguments
+    if( 1 > argv.Length() || !argv[0]->IsString() ){
+        return ThrowException( Exception::TypeError( String::New( "saveSnapshot( path:String )" ) ) );
+    }
+    
+    memset( &head, 0, sizeof( SnapshotHeader_t ) );
+    memcpy( head.magic, SNAPSHOT_MAGIC, 4 );
+    head.version = SNAPSHOT_VERSION;
+    head.byteorder = SNAPSHOT_BYTEORDER;
+    string_init( &str );
+    // reserve header
+    nerr = string_appendn( &str, (const char*)&head, sizeof( SnapshotHeader_t ) );
+    
+    // parsers; parseCache is touched from main thread only
+    if( STATUS_OK == nerr )
+    {
+        void *key = NULL;
+        ParseCtx_t *ctx = NULL;
+        
+        while( STATUS_OK == nerr &&
+               ( ctx = (ParseCtx_t*)ne_hash_next( cs->parseCache, &key ) ) )
+        {
+            char *dump = NULL;
+            
+            // not compiled
+            if( !ctx->src ){
+                continue;
+            }
+            pthread_rwlock_rdlock( &ctx->lock );
+            nerr = hdf_write_string( ctx->hdf, &dump );
+            pthread_rwlock_unlock( &ctx->lock );
+            if( STATUS_OK == nerr &&
+                STATUS_OK == ( nerr = PutString( &str, ctx->id ) ) &&
+                STATUS_OK == ( nerr = PutString( &str, dump ) ) &&
+                STATUS_OK == ( nerr = PutBytes( &str, ctx->src, ctx->srclen ) ) ){
+                head.nparsers++;
+            }
+            free( dump );
+        }
+    }
+    
+    // include files and paths
+    if( STATUS_OK == nerr )
+    {
+        if( ( rc = pthread_mutex_lock( &cs->mutex ) ) ){
+            nerr = nerr_raise( NERR_LOCK, "%s", strerror(rc) );
+        }
+        else
+        {
+            FileCache_t *entry = NULL;
+            PathCache_t *path = NULL;
+            void *key = NULL;
+            
+            for( entry = cs->lruHead; STATUS_OK == nerr && entry; entry = entry->next )
+            {
+                if( STATUS_OK == ( nerr = PutString( &str, entry->id ) ) &&
+                    STATUS_OK == ( nerr = PutInt64( &str, entry->mtime ) ) &&
+                    STATUS_OK == ( nerr = PutInt64( &str, entry->size ) ) &&
+                    STATUS_OK == ( nerr = PutBytes( &str, entry->data, entry->len ) ) ){
+                    head.nfiles++;
+                }
+            }
+            while( STATUS_OK == nerr &&
+                   ( path = (PathCache_t*)ne_hash_next( cs->pathCache, &key ) ) )
+            {
+                // empty path is a negative entry
+                if( STATUS_OK == ( nerr = PutString( &str, path->id ) ) &&
+                    STATUS_OK == ( nerr = PutString( &str, path->path ) ) ){
+                    head.npaths++;
+                }
+            }
+            pthread_mutex_unlock( &cs->mutex );
+        }
+    }
+    
+    if( STATUS_OK == nerr )
+    {
+        head.bodylen = str.len - sizeof( SnapshotHeader_t );
+        head.crc = ne_crc( (UINT8*)str.buf + sizeof( SnapshotHeader_t ), head.bodylen );
+        memcpy( str.buf, &head, sizeof( SnapshotHeader_t ) );
+        nerr = WriteFile( *String::Utf8Value( argv[0] ), &str );
+    }
+    string_clear( &str );
+    
+    if( ( estr = CHECK_NEOERR( nerr ) ) ){
+        retval = ThrowException( Exception::Error( String::New( estr ) ) );
+        free( estr );
+    }
+    
+    return scope.Close( retval );
+}
+
+// parser_ids:Array loadSnapshot( path:String )
+//  returns null if snapshot is missing or unusable. cached files that
+//  changed on disk are skipped; parsers already registered are kept.
+//  a restored parser is compiled from the saved source; the next
+//  parseString with the same source returns without compiling again.
+Handle<Value> ClearSilver::loadSnapshot( const Arguments &argv )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    Handle<Value> retval = Null();
+    SnapshotHeader_t head;
+    struct stat info;
+    char *map = NULL;
+    // info is reused for include files below
+    off_t maplen = 0;
+    int fd = -1;
+    
+    // invalid arguments
+    if( 1 > argv.Length() || !argv[0]->IsString() ){
+        return ThrowException( Exception::TypeError( String::New( "loadSnapshot( path:String )" ) ) );
+    }
+    else if( -1 == ( fd = open( *String::Utf8Value( argv[0] ), O_RDONLY ) ) ){
+        return scope.Close( retval );
+    }
+    else if( 0 != fstat( fd, &info ) || info.st_size < (off_t)sizeof( SnapshotHeader_t ) ||
+             MAP_FAILED == ( map = (char*)mmap( NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 ) ) ){
+        close( fd );
+        return scope.Close( retval );
+    }
+    close( fd );
+    maplen = info.st_size;
+    
+    memcpy( &head, map, sizeof( SnapshotHeader_t ) );
+    // validate
+    if( !memcmp( head.magic, SNAPSHOT_MAGIC, 4 ) &&
+        head.version == SNAPSHOT_VERSION &&
+        head.byteorder == SNAPSHOT_BYTEORDER &&
+        (off_t)head.bodylen == maplen - (off_t)sizeof( SnapshotHeader_t ) &&
+        head.crc == ne_crc( (UINT8*)map + sizeof( SnapshotHeader_t ), head.bodylen ) )
+    {
+        Local<Array> ids = Array::New();
+        const char *cur = map + sizeof( SnapshotHeader_t );
+        const char *end = cur + head.bodylen;
+        const char *parsers = cur;
+        const char *id, *dump, *src, *data;
+        uint32_t idlen, dumplen, srclen, len;
+        int64_t mtime, size;
+        uint32_t i = 0;
+        bool valid = true;
+        
+        // skip parsers; includes must be in the cache before compiling
+        for( i = 0; valid && i < head.nparsers; i++ ){
+            valid = GetBytes( &cur, end, &id, &idlen ) &&
+                    GetBytes( &cur, end, &dump, &dumplen ) &&
+                    GetBytes( &cur, end, &src, &srclen );
+        }
+        
+        // include files
+        if( valid && 0 == pthread_mutex_lock( &cs->mutex ) )
+        {
+            for( i = 0; i < head.nfiles; i++ )
+            {
+                FileCache_t *cache = NULL;
+                char *path = NULL;
+                NEOERR *nerr = STATUS_OK;
+                
+                if( !( valid = GetBytes( &cur, end, &id, &idlen ) &&
+                               GetInt64( &cur, end, &mtime ) &&
+                               GetInt64( &cur, end, &size ) &&
+                               GetBytes( &cur, end, &data, &len ) ) ){
+                    break;
+                }
+                else if( !( path = DupBytes( id, idlen ) ) ){
+                    continue;
+                }
+                // skip cached or changed file
+                else if( ne_hash_lookup( cs->fileCache, path ) ||
+                         0 != stat( path, &info ) ||
+                         info.st_mtime != mtime || info.st_size != size ||
+                         !( cache = (FileCache_t*)calloc( 1, sizeof( FileCache_t ) ) ) ){
+                    free( path );
+                    continue;
+                }
+                
+                cache->id = path;
+                cache->refs = 1;
+                cache->mtime = mtime;
+                cache->size = size;
+                if( !( cache->data = DupBytes( data, len ) ) ||
+                    STATUS_OK != ( nerr = ne_hash_insert( cs->fileCache, cache->id, (void*)cache ) ) ){
+                    nerr_ignore( &nerr );
+                    free( cache->data );
+                    free( cache->id );
+                    free( cache );
+                    continue;
+                }
+                cache->len = len;
+                if( STATUS_OK != ( nerr = LoadTree( cache ) ) ){
+                    nerr_ignore( &nerr );
+                }
+                cs->_cacheLink( cache );
+            }
+            pthread_mutex_unlock( &cs->mutex );
+        }
+        
+        // resolved paths
+        for( i = 0; valid && i < head.npaths; i++ )
+        {
+            char *key = NULL;
+            char *path = NULL;
+            
+            if( ( valid = GetBytes( &cur, end, &id, &idlen ) &&
+                          GetBytes( &cur, end, &data, &len ) ) &&
+                ( key = DupBytes( id, idlen ) ) &&
+                ( !len || ( path = DupBytes( data, len ) ) ) ){
+                cs->_pathStore( key, path );
+            }
+            free( key );
+            free( path );
+        }
+        
+        // parsers
+        for( cur = parsers, i = 0; valid && i < head.nparsers; i++ )
+        {
+            ParseCtx_t *ctx = NULL;
+            Tree_t *tree = NULL;
+            char *str = NULL;
+            NEOERR *nerr = STATUS_OK;
+            Handle<Value> parser_id;
+            
+            GetBytes( &cur, end, &id, &idlen );
+            GetBytes( &cur, end, &dump, &dumplen );
+            GetBytes( &cur, end, &src, &srclen );
+            // already registered
+            if( !( str = DupBytes( id, idlen ) ) || ne_hash_lookup( cs->parseCache, str ) ){
+                free( str );
+                continue;
+            }
+            parser_id = cs->_createParser( String::New( str ), &ctx );
+            free( str );
+            if( !parser_id->IsString() ){
+                continue;
+            }
+            else if( !( str = DupBytes( dump, dumplen ) ) ||
+                     STATUS_OK != ( nerr = hdf_read_string( ctx->hdf, str ) ) ||
+                     STATUS_OK != ( nerr = _compile( ctx, ctx->hdf, src, srclen, &tree ) ) ||
+                     !SetSource( ctx, src, srclen ) )
+            {
+                nerr_ignore( &nerr );
+                ReleaseTree( tree );
+                ne_hash_remove( cs->parseCache, (void*)ctx->id );
+                ReleaseContext( ctx );
+            }
+            else {
+                InstallTree( ctx, tree, ++ctx->treeSeq );
+                ctx->snapshot = true;
+                ids->Set( ids->Length(), parser_id );
+            }
+            free( str );
+        }
+        
+        if( valid ){
+            retval = ids;
+        }
+    }
+    munmap( map, maplen );
+    
+    return scope.Close( retval );
+}
+
+// MARK: preload
+typedef struct {
+    // path to file
+    char *path;
+    // parser_id; path relative to dir
+    char *id;
+    ParseCtx_t *ctx;
+    char *estr;
+} PreloadItem_t;
+
+typedef struct {
+    ClearSilver *cs;
+    Persistent<Function> callback;
+    char *dir;
+    char *pattern;
+    uint32_t concurrency;
+    PreloadItem_t *items;
+    uint32_t nitems;
+    uint32_t maxitems;
+    // next item to compile; claimed by workers
+    uint32_t next;
+    // workers in progress
+    uint32_t running;
+    char *estr;
+    struct timeval start;
+} Preload_t;
+
+// add a file to compile, or one that failed already with estr
+static NEOERR *PreloadAdd( Preload_t *batch, const char *path, const char *id, const char *estr )
+{
+    PreloadItem_t *item = NULL;
+    
+    if( batch->nitems == batch->maxitems )
+    {
+        uint32_t max = ( batch->maxitems ) ? batch->maxitems * 2 : 64;
+        
+        if( !( item = (PreloadItem_t*)realloc( batch->items, sizeof( PreloadItem_t ) * max ) ) ){
+            return nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+        }
+        batch->items = item;
+        batch->maxitems = max;
+    }
+    item = &batch->items[batch->nitems];
+    memset( item, 0, sizeof( PreloadItem_t ) );
+    if( !( item->path = strdup( path ) ) || !( item->id = strdup( id ) ) ||
+        ( estr && !( item->estr = strdup( estr ) ) ) ){
+        free( item->path );
+        free( item->id );
+        return nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+    }
+    batch->nitems++;
+    
+    return STATUS_OK;
+}
+
+// directory on the way down from dir; symlinks are followed, and one
+// back to any of them would recurse forever
+typedef struct PreloadDir_t PreloadDir_t;
+struct PreloadDir_t {
+    dev_t dev;
+    ino_t ino;
+    const PreloadDir_t *parent;
+};
+
+// collect files matching pattern under dir/rel. paths over PATH_MAX and
+// symlinked directory loops are reported as errors of their entry.
+static NEOERR *PreloadScan( Preload_t *batch, const char *rel, const PreloadDir_t *parent )
+{
+    NEOERR *nerr = STATUS_OK;
+    char path[PATH_MAX];
+    char id[PATH_MAX];
+    struct dirent *entry = NULL;
+    struct stat info;
+    DIR *dir = NULL;
+    PreloadDir_t self;
+    const PreloadDir_t *up = NULL;
+    
+    snprintf( path, PATH_MAX, "%s%s%s", batch->dir, ( *rel ) ? "/" : "", rel );
+    if( !( dir = opendir( path ) ) ){
+        return nerr_raise( ( errno == ENOENT ) ? NERR_NOT_FOUND : NERR_IO, "%s: %s", path, strerror(errno) );
+    }
+    else if( 0 != fstat( dirfd( dir ), &info ) ){
+        nerr = nerr_raise( NERR_IO, "%s: %s", path, strerror(errno) );
+        closedir( dir );
+        return nerr;
+    }
+    self.dev = info.st_dev;
+    self.ino = info.st_ino;
+    self.parent = parent;
+    
+    while( STATUS_OK == nerr && ( entry = readdir( dir ) ) )
+    {
+        // skip hidden files
+        if( '.' == *entry->d_name ){
+            continue;
+        }
+        // truncated
+        if( PATH_MAX <= snprintf( id, PATH_MAX, "%s%s%s", rel, ( *rel ) ? "/" : "", entry->d_name ) ||
+            PATH_MAX <= snprintf( path, PATH_MAX, "%s/%s", batch->dir, id ) ){
+            nerr = PreloadAdd( batch, path, id, strerror(ENAMETOOLONG) );
+        }
+        else if( 0 != stat( path, &info ) ){
+            continue;
+        }
+        else if( S_ISDIR( info.st_mode ) )
+        {
+            for( up = &self; up && ( up->dev != info.st_dev || up->ino != info.st_ino ); up = up->parent ){}
+            nerr = ( up ) ? PreloadAdd( batch, path, id, strerror(ELOOP) ) : PreloadScan( batch, id, &self );
+        }
+        else if( S_ISREG( info.st_mode ) && 0 == fnmatch( batch->pattern, entry->d_name, 0 ) ){
+            nerr = PreloadAdd( batch, path, id, NULL );
+        }
+    }
+    closedir( dir );
+    
+    return nerr_pass( nerr );
+}
+
+static void DestroyPreload( Preload_t *batch )
+{
+    uint32_t i = 0;
+    
+    for( i = 0; i < batch->nitems; i++ )
+    {
+        PreloadItem_t *item = &batch->items[i];
+        
+        free( item->path );
+        free( item->id );
+        free( item->estr );
+        DestroyContext( item->ctx );
+    }
+    free( batch->items );
+    free( batch->dir );
+    free( batch->pattern );
+    free( batch->estr );
+    batch->callback.Dispose();
+    delete batch;
+}
+
+// preload( dir:String, [options:Object], callback:Function )
+//  options.pattern: glob matched against file name, default "*"
+//  options.concurrency: number of compile jobs, default number of cpus
+//  callback( err, { parsers:Array, errors:Object, time:Number } )
+//  every file is compiled into a parser identified by its path relative
+//  to dir, with dir as Config.loadpaths. ids already registered, paths
+//  longer than PATH_MAX and symlinks back to a directory above them are
+//  reported in errors.
+Handle<Value> ClearSilver::preload( const Arguments &argv )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    const int argc = argv.Length();
+    Handle<Value> retval = Undefined();
+    int opts = ( 2 < argc && argv[1]->IsObject() ) ? 1 : 0;
+    
+    // invalid arguments
+    if( 2 > argc || !argv[0]->IsString() || !argv[1+opts]->IsFunction() ){
+        retval = ThrowException( Exception::TypeError( String::New( "preload( dir:String, [options:Object], callback:Function )" ) ) );
+    }
+    else
+    {
+        Preload_t *batch = new Preload_t();
+        Local<Object> options = ( opts ) ? argv[1]->ToObject() : Object::New();
+        Local<Value> val = options->Get( String::NewSymbol("pattern") );
+        String::Utf8Value dir( argv[0] );
+        String::Utf8Value glob( val );
+        const char *pattern = ( val->IsString() ) ? *glob : "*";
+        
+        batch->cs = cs;
+        batch->concurrency = NumCPU();
+        if( opts )
+        {
+            val = options->Get( String::NewSymbol("concurrency") );
+            if( val->IsNumber() && 0 < val->Int32Value() ){
+                batch->concurrency = val->Uint32Value();
+            }
+        }
+        
+        // loadpaths are matched against realpaths of includes; a missing
+        // dir is kept as given and reported by the scan
+        if( !( ( batch->dir = realpath( *dir, NULL ) ) || ( batch->dir = strdup( *dir ) ) ) ||
+            !( batch->pattern = strdup( pattern ) ) ){
+            retval = ThrowException( Exception::Error( String::New( strerror(errno) ) ) );
+            DestroyPreload( batch );
+        }
+        else
+        {
+            // drop trailing slash
+            size_t len = strlen( batch->dir );
+            while( 1 < len && '/' == batch->dir[len-1] ){
+                batch->dir[--len] = 0;
+            }
+            gettimeofday( &batch->start, NULL );
+            // detouch from GC
+            batch->callback = Persistent<Function>::New( Local<Function>::Cast( argv[1+opts] ) );
+            cs->Ref();
+            ev_ref(EV_DEFAULT_UC);
+            eio_custom( preloadScanEIO, EIO_PRI_DEFAULT, preloadScanEndEIO, batch );
+        }
+    }
+    
+    return scope.Close( retval );
+}
+
+int ClearSilver::preloadScanEIO( eio_req *req )
+{
+    Preload_t *batch = static_cast<Preload_t*>(req->data);
+    
+    batch->estr = CHECK_NEOERR( PreloadScan( batch, "", NULL ) );
+    
+    return 0;
+}
+
+int ClearSilver::preloadScanEndEIO( eio_req *req )
+{
+    Preload_t *batch = static_cast<Preload_t*>(req->data);
+    uint32_t i = 0;
+    
+    // contexts are created here and registered when all jobs are done
+    for( i = 0; !batch->estr && i < batch->nitems; i++ )
+    {
+        PreloadItem_t *item = &batch->items[i];
+        
+        if( item->estr ){
+            // failed while scanning
+        }
+        else if( ( item->ctx = CreateContext( item->id, &item->estr ) ) )
+        {
+            item->ctx->cs = batch->cs;
+            if( ( item->estr = CHECK_NEOERR( hdf_set_value( item->ctx->hdf, "Config.loadpaths.0", batch->dir ) ) ) ){
+                DestroyContext( item->ctx );
+                item->ctx = NULL;
+            }
+        }
+    }
+    
+    batch->running = ( batch->estr ) ? 0 :
+                     ( batch->concurrency < batch->nitems ) ? batch->concurrency : batch->nitems;
+    if( !batch->running ){
+        batch->running = 1;
+        preloadEndEIO( req );
+    }
+    else
+    {
+        // one scan job becomes running jobs
+        for( i = 1; i < batch->running; i++ ){
+            ev_ref(EV_DEFAULT_UC);
+        }
+        for( i = 0; i < batch->running; i++ ){
+            eio_custom( preloadBeginEIO, EIO_PRI_DEFAULT, preloadEndEIO, batch );
+        }
+        eio_cancel(req);
+    }
+    
+    return 0;
+}
+
+int ClearSilver::preloadBeginEIO( eio_req *req )
+{
+    Preload_t *batch = static_cast<Preload_t*>(req->data);
+    uint32_t i = 0;
+    
+    while( ( i = __sync_fetch_and_add( &batch->next, 1 ) ) < batch->nitems )
+    {
+        PreloadItem_t *item = &batch->items[i];
+        NEOERR *nerr = STATUS_OK;
+        Tree_t *tree = NULL;
+        char *src = NULL;
+        
+        if( !item->ctx ){
+            continue;
+        }
+        else if( STATUS_OK == ( nerr = ne_load_file( item->path, &src ) ) &&
+                 STATUS_OK == ( nerr = _compile( item->ctx, item->ctx->hdf, src, strlen( src ), &tree ) ) )
+        {
+            if( !SetSource( item->ctx, src, strlen( src ) ) ){
+                nerr = nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+                ReleaseTree( tree );
+            }
+            else {
+                InstallTree( item->ctx, tree, ++item->ctx->treeSeq );
+            }
+        }
+        free( src );
+        item->estr = CHECK_NEOERR( nerr );
+    }
+    
+    return 0;
+}
+
+int ClearSilver::preloadEndEIO( eio_req *req )
+{
+    HandleScope scope;
+    Preload_t *batch = static_cast<Preload_t*>(req->data);
+    Handle<Primitive> t = Undefined();
+    Local<Value> argv[] = {
+        reinterpret_cast<Local<Value>&>(t),
+        reinterpret_cast<Local<Value>&>(t)
+    };
+    struct timeval now;
+    uint32_t i = 0;
+    
+    ev_unref(EV_DEFAULT_UC);
+    if( --batch->running ){
+        eio_cancel(req);
+        return 0;
+    }
+    batch->cs->Unref();
+    
+    if( batch->estr ){
+        argv[0] = Exception::Error( String::New( batch->estr ) );
+    }
+    else
+    {
+        Local<Object> result = Object::New();
+        Local<Array> parsers = Array::New();
+        Local<Object> errors = Object::New();
+        
+        for( i = 0; i < batch->nitems; i++ )
+        {
+            PreloadItem_t *item = &batch->items[i];
+            char *estr = NULL;
+            
+            if( item->estr ){
+                errors->Set( String::New( item->id ), String::New( item->estr ) );
+            }
+            else if( ne_hash_lookup( batch->cs->parseCache, (void*)item->ctx->id ) ){
+                errors->Set( String::New( item->id ), String::New( "parser already exists" ) );
+            }
+            else if( ( estr = CHECK_NEOERR( ne_hash_insert( batch->cs->parseCache, (void*)item->ctx->id, (void*)item->ctx ) ) ) ){
+                errors->Set( String::New( item->id ), String::New( estr ) );
+                free( estr );
+            }
+            else {
+                parsers->Set( parsers->Length(), String::New( item->ctx->id ) );
+                // owned by parseCache
+                item->ctx = NULL;
+            }
+        }
+        gettimeofday( &now, NULL );
+        result->Set( String::NewSymbol("parsers"), parsers );
+        result->Set( String::NewSymbol("errors"), errors );
+        result->Set( String::NewSymbol("time"), Number::New( ( now.tv_sec - batch->start.tv_sec ) * 1000.0 +
+                                                            ( now.tv_usec - batch->start.tv_usec ) / 1000.0 ) );
+        argv[1] = result;
+    }
+    
+    TryCatch try_catch;
+    // call js function by callback function context
+    batch->callback->Call( batch->callback, 2, argv );
+    if( try_catch.HasCaught() ){
+        FatalException(try_catch);
+    }
+    DestroyPreload( batch );
+    
+    eio_cancel(req);
+    
+    return 0;
+}
+
+static inline bool IsAncestor( Ancestors_t *path, Local<Object> obj, int hash )
+{
+    // common case: no ancestor in bucket
+    if( path->buckets[hash & (ANCESTOR_BUCKETS-1)] )
+    {
+        for( uint32_t i = 0; i < path->depth; i++ )
+        {
+            if( path->hashes[i] == hash && path->objs[i]->StrictEquals( obj ) ){
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static inline bool PushAncestor( Ancestors_t *path, Local<Object> obj, int hash )
+{
+    if( path->depth == path->max )
+    {
+        uint32_t max = ( path->max ) ? path->max * 2 : 32;
+        Local<Object> *objs = new Local<Object>[max];
+        int *hashes = (int*)realloc( path->hashes, sizeof( int ) * max );
+        
+        if( !hashes ){
+            delete[] objs;
+            return false;
+        }
+        for( uint32_t i = 0; i < path->depth; i++ ){
+            objs[i] = path->objs[i];
+        }
+        delete[] path->objs;
+        path->objs = objs;
+        path->hashes = hashes;
+        path->max = max;
+    }
+    path->objs[path->depth] = obj;
+    path->hashes[path->depth] = hash;
+    path->depth++;
+    path->buckets[hash & (ANCESTOR_BUCKETS-1)]++;
+    
+    return true;
+}
+
+static inline void PopAncestor( Ancestors_t *path )
+{
+    path->depth--;
+    path->buckets[path->hashes[path->depth] & (ANCESTOR_BUCKETS-1)]--;
+}
+
+// reserve len bytes of scratch buffer
+static inline char *ConvReserve( ConvBuf_t *conv, size_t len )
+{
+    if( len > conv->max )
+    {
+        size_t max = ( conv->max ) ? conv->max * 2 : 256;
+        char *buf = NULL;
+        
+        while( max < len ){
+            max *= 2;
+        }
+        if( !( buf = (char*)realloc( conv->buf, max ) ) ){
+            return NULL;
+        }
+        conv->buf = buf;
+        conv->max = max;
+    }
+    return conv->buf;
+}
+
+// write str as NUL terminated utf8 at offset of scratch buffer
+static inline char *ConvUtf8( ConvBuf_t *conv, size_t offset, Handle<String> str )
+{
+    // 3 bytes per utf16 unit is the upper bound; avoids Utf8Length pass
+    size_t len = str->Length() * 3 + 1;
+    
+    if( !ConvReserve( conv, offset + len ) ){
+        return NULL;
+    }
+    str->WriteUtf8( conv->buf + offset, len );
+    conv->buf[offset+len-1] = 0;
+    
+    return conv->buf + offset;
+}
+
+// set properties of obj relative to hdf node; keys and string values go
+// through one scratch buffer and nested objects are set on their own
+// node, so no dotted path is built per leaf
+inline Handle<Value> ClearSilver::_setValue( HDF *hdf, Local<Object> obj, Local<Array> props, ConvBuf_t *conv, Ancestors_t *path )
+{
+    Handle<Value> retval = Undefined();
+    uint32_t len = props->Length();
+    NEOERR *nerr = STATUS_OK;
+    Local<Value> key;
+    Local<Value> val;
+    uint32_t valType;
+    char *name = NULL;
+    size_t klen = 0;
+    
+    for( uint32_t idx = 0; STATUS_OK == nerr && idx < len; idx++ )
+    {
+        key = props->Get(idx);
+        val = obj->Get(key);
+        valType = TypeOf( val );
+        
+        if( !( valType & ( isPrintable|isRecursive|isRemoval ) ) ){
+            continue;
+        }
+        else if( !( name = ConvUtf8( conv, 0, key->ToString() ) ) ){
+            nerr = nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+            break;
+        }
+        klen = strlen( name ) + 1;
+        
+        if( valType & isPrintable )
+        {
+            // Date milliseconds to iso8601
+            if( valType & JS_TYPE_DATE_BIT ){
+                char iso8601[ISO8601_STRING_LEN];
+                MSEC_TO_ISO8601(iso8601,val->IntegerValue());
+                nerr = hdf_set_value( hdf, name, iso8601 );
+            }
+            else if( valType & JS_TYPE_BOOLEAN_BIT ){
+                nerr = hdf_set_int_value( hdf, name, ( val->BooleanValue() ) ? 1 : 0 );
+            }
+            else if( val->IsInt32() ){
+                nerr = hdf_set_int_value( hdf, name, val->Int32Value() );
+            }
+            else
+            {
+                char *str = ConvUtf8( conv, klen, val->ToString() );
+                
+                if( !str ){
+                    nerr = nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+                }
+                else {
+                    // buffer may have moved
+                    nerr = hdf_set_value( hdf, conv->buf, str );
+                }
+            }
+        }
+        else if( valType & isRecursive )
+        {
+            Local<Object> child = val->ToObject();
+            int hash = child->GetIdentityHash();
+            
+            // check is circulative object
+            if( IsAncestor( path, child, hash ) ){
+                nerr = hdf_set_value( hdf, name, "[Circular]" );
+            }
+            else
+            {
+                Local<Array> names = child->GetPropertyNames();
+                HDF *node = NULL;
+                
+                // empty object leaves no node, as before
+                if( !names->Length() ){
+                    continue;
+                }
+                else if( !PushAncestor( path, child, hash ) ){
+                    nerr = nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+                }
+                else if( STATUS_OK == ( nerr = hdf_get_node( hdf, name, &node ) ) )
+                {
+                    retval = _setValue( node, child, names, conv, path );
+                    PopAncestor( path );
+                    if( !retval->IsUndefined() ){
+                        return retval;
+                    }
+                }
+                else {
+                    PopAncestor( path );
+                }
+            }
+        }
+        else {
+            nerr = hdf_remove_tree( hdf, name );
+            conv->removed = true;
+        }
+    }
+    
+    if( STATUS_OK != nerr ){
+        char *estr = CHECK_NEOERR( nerr );
+        retval = ThrowException( Exception::Error( String::New( estr ) ) );
+        free(estr);
+    }
+    
+    return retval;
+}
+
+// set obj below key of hdf; key may be NULL or empty for the root.
+// *removed is set if a node was removed
+Handle<Value> ClearSilver::_setObject( HDF *hdf, const char *key, Local<Object> obj, bool *removed )
+{
+    Handle<Value> retval = Undefined();
+    Local<Array> props = obj->GetPropertyNames();
+    ConvBuf_t conv = { NULL, 0, false };
+    Ancestors_t path;
+    char *estr = NULL;
+    
+    if( !props->Length() ){
+        return retval;
+    }
+    else if( key && *key && ( estr = CHECK_NEOERR( hdf_get_node( hdf, key, &hdf ) ) ) ){
+        retval = ThrowException( Exception::Error( String::New( estr ) ) );
+        free(estr);
+        return retval;
+    }
+    
+    memset( &path, 0, sizeof( Ancestors_t ) );
+    // set root object
+    if( !PushAncestor( &path, obj, obj->GetIdentityHash() ) ){
+        retval = ThrowException( Exception::Error( String::New( strerror(errno) ) ) );
+    }
+    else {
+        retval = _setValue( hdf, obj, props, &conv, &path );
+    }
+    if( removed ){
+        *removed = conv.removed;
+    }
+    delete[] path.objs;
+    free( path.hashes );
+    free( conv.buf );
+    
+    return retval;
+}
+
+// MARK: diff mode setValue
+#define FNV64_OFFSET    14695981039346656037ULL
+#define FNV64_PRIME     1099511628211ULL
+
+static inline uint64_t FNV1a64( uint64_t hash, const void *data, size_t len )
+{
+    const unsigned char *ptr = (const unsigned char*)data;
+    
+    while( len-- ){
+        hash = ( hash ^ *ptr++ ) * FNV64_PRIME;
+    }
+    return hash;
+}
+
+// write leaf as NUL terminated string at offset of scratch buffer,
+// formatted the way _setValue stores it
+static inline char *ConvLeaf( ConvBuf_t *conv, size_t offset, Handle<Value> val, uint32_t valType )
+{
+    if( valType & ( JS_TYPE_DATE_BIT|JS_TYPE_BOOLEAN_BIT ) || val->IsInt32() )
+    {
+        if( !ConvReserve( conv, offset + ISO8601_STRING_LEN ) ){
+            return NULL;
+        }
+        else if( valType & JS_TYPE_DATE_BIT ){
+            MSEC_TO_ISO8601( conv->buf + offset, val->IntegerValue() );
+        }
+        else if( valType & JS_TYPE_BOOLEAN_BIT ){
+            snprintf( conv->buf + offset, ISO8601_STRING_LEN, "%d", ( val->BooleanValue() ) ? 1 : 0 );
+        }
+        else {
+            snprintf( conv->buf + offset, ISO8601_STRING_LEN, "%d", val->Int32Value() );
+        }
+        return conv->buf + offset;
+    }
+    
+    return ConvUtf8( conv, offset, val->ToString() );
+}
+
+static inline NEOERR *AddPrint( Prints_t *prints, uint32_t *idx )
+{
+    if( prints->num == prints->max )
+    {
+        uint32_t max = ( prints->max ) ? prints->max * 2 : 64;
+        Print_t *list = (Print_t*)realloc( prints->list, sizeof( Print_t ) * max );
+        
+        if( !list ){
+            return nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+        }
+        prints->list = list;
+        prints->max = max;
+    }
+    *idx = prints->num++;
+    
+    return STATUS_OK;
+}
+
+// pass 1: fingerprint every non-empty object of the model; keys are
+// visited in the same order and with the same rules as _diffValue
+NEOERR *ClearSilver::_fingerprint( Local<Object> obj, Local<Array> props, ConvBuf_t *conv, Ancestors_t *path, Prints_t *prints )
+{
+    NEOERR *nerr = STATUS_OK;
+    uint32_t len = props->Length();
+    uint64_t hash = FNV64_OFFSET;
+    uint32_t idx = 0;
+    Local<Value> key;
+    Local<Value> val;
+    uint32_t valType;
+    char *str = NULL;
+    
+    if( STATUS_OK != ( nerr = AddPrint( prints, &idx ) ) ){
+        return nerr;
+    }
+    
+    for( uint32_t i = 0; STATUS_OK == nerr && i < len; i++ )
+    {
+        key = props->Get(i);
+        val = obj->Get(key);
+        valType = TypeOf( val );
+        
+        if( !( valType & ( isPrintable|isRecursive|isRemoval ) ) ){
+            continue;
+        }
+        else if( !( str = ConvUtf8( conv, 0, key->ToString() ) ) ){
+            return nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+        }
+        // key with terminator, then a type tag
+        hash = FNV1a64( hash, str, strlen( str ) + 1 );
+        hash = FNV1a64( hash, &valType, sizeof( uint32_t ) );
+        
+        if( valType & isPrintable )
+        {
+            if( !( str = ConvLeaf( conv, 0, val, valType ) ) ){
+                return nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+            }
+            hash = FNV1a64( hash, str, strlen( str ) );
+        }
+        else if( valType & isRecursive )
+        {
+            Local<Object> child = val->ToObject();
+            int ihash = child->GetIdentityHash();
+            Local<Array> names;
+            
+            if( IsAncestor( path, child, ihash ) ){
+                hash = FNV1a64( hash, "[Circular]", 10 );
+            }
+            else if( ( names = child->GetPropertyNames() )->Length() )
+            {
+                uint32_t cidx = prints->num;
+                
+                if( !PushAncestor( path, child, ihash ) ){
+                    return nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+                }
+                nerr = _fingerprint( child, names, conv, path, prints );
+                PopAncestor( path );
+                if( STATUS_OK == nerr ){
+                    hash = FNV1a64( hash, &prints->list[cidx].hash, sizeof( uint64_t ) );
+                }
+            }
+        }
+    }
+    prints->list[idx].hash = hash;
+    prints->list[idx].size = prints->num - idx;
+    
+    return nerr;
+}
+
+// pass 2: write the changed object at prints->list[*cursor] into hdf;
+// unchanged subobjects are skipped, keys missing since the last call
+// are removed
+NEOERR *ClearSilver::_diffValue( HDF *hdf, HDF *shadow, Local<Object> obj, Local<Array> props, ConvBuf_t *conv, Ancestors_t *path, Prints_t *prints, uint32_t *cursor )
+{
+    NEOERR *nerr = STATUS_OK;
+    uint32_t len = props->Length();
+    Local<Value> key;
+    Local<Value> val;
+    uint32_t valType;
+    HDF *snode = NULL;
+    HDF *next = NULL;
+    char *name = NULL;
+    char *str = NULL;
+    char *cur = NULL;
+    size_t klen = 0;
+    
+    (*cursor)++;
+    for( uint32_t i = 0; STATUS_OK == nerr && i < len; i++ )
+    {
+        key = props->Get(i);
+        val = obj->Get(key);
+        valType = TypeOf( val );
+        
+        if( !( valType & ( isPrintable|isRecursive|isRemoval ) ) ){
+            continue;
+        }
+        else if( !( name = ConvUtf8( conv, 0, key->ToString() ) ) ){
+            return nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+        }
+        klen = strlen( name ) + 1;
+        
+        if( valType & isRemoval ){
+            conv->removed = true;
+            if( STATUS_OK == ( nerr = hdf_remove_tree( hdf, name ) ) ){
+                nerr = hdf_remove_tree( shadow, name );
+            }
+            continue;
+        }
+        // remember key
+        else if( STATUS_OK != ( nerr = hdf_get_node( shadow, name, &snode ) ) ){
+            break;
+        }
+        
+        if( valType & isPrintable )
+        {
+            if( !( str = ConvLeaf( conv, klen, val, valType ) ) ){
+                nerr = nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+            }
+            // set only changed leaf; buffer may have moved
+            else if( !( cur = hdf_get_value( hdf, conv->buf, NULL ) ) || strcmp( cur, str ) ){
+                nerr = hdf_set_value( hdf, conv->buf, str );
+            }
+        }
+        else
+        {
+            Local<Object> child = val->ToObject();
+            int ihash = child->GetIdentityHash();
+            Local<Array> names;
+            
+            if( IsAncestor( path, child, ihash ) )
+            {
+                if( !( cur = hdf_get_value( hdf, name, NULL ) ) || strcmp( cur, "[Circular]" ) ){
+                    nerr = hdf_set_value( hdf, name, "[Circular]" );
+                }
+            }
+            else if( ( names = child->GetPropertyNames() )->Length() )
+            {
+                Print_t *print = &prints->list[*cursor];
+                char hex[17];
+                HDF *node = NULL;
+                
+                snprintf( hex, sizeof( hex ), "%016llx", (unsigned long long)print->hash );
+                // unchanged subtree
+                if( ( cur = hdf_obj_value( snode ) ) && !strcmp( cur, hex ) ){
+                    *cursor += print->size;
+                }
+                else if( !PushAncestor( path, child, ihash ) ){
+                    nerr = nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+                }
+                else
+                {
+                    if( STATUS_OK == ( nerr = hdf_get_node( hdf, name, &node ) ) &&
+                        STATUS_OK == ( nerr = _diffValue( node, snode, child, names, conv, path, prints, cursor ) ) ){
+                        nerr = hdf_set_value( snode, NULL, hex );
+                    }
+                    PopAncestor( path );
+                }
+            }
+        }
+    }
+    
+    // remove keys gone since the last call
+    for( snode = hdf_obj_child( shadow ); STATUS_OK == nerr && snode; snode = next )
+    {
+        next = hdf_obj_next( snode );
+        name = hdf_obj_name( snode );
+        if( !obj->Has( String::New( name ) ) && STATUS_OK == ( nerr = hdf_remove_tree( hdf, name ) ) ){
+            conv->removed = true;
+            nerr = hdf_remove_tree( shadow, name );
+        }
+    }
+    
+    return nerr_pass( nerr );
+}
+
+// shadow of a keyed call is "k" and the hex of its key, so keys with dots
+// do not nest into each other; the unkeyed one is "n"
+static char *ShadowKey( const char *key )
+{
+    size_t len = ( key ) ? strlen( key ) : 0;
+    char *skey = (char*)malloc( len * 2 + 2 );
+    size_t i = 0;
+    
+    if( skey && !len ){
+        strcpy( skey, "n" );
+    }
+    else if( skey )
+    {
+        skey[0] = 'k';
+        for( i = 0; i < len; i++ ){
+            snprintf( skey + 1 + i * 2, 3, "%02x", (unsigned char)key[i] );
+        }
+    }
+    return skey;
+}
+
+// true if the data of shadow a contains the data of shadow b
+static inline bool ShadowCovers( const char *a, const char *b )
+{
+    size_t len = strlen( a );
+    
+    // hex "2e" is the dot of a key path
+    return !strcmp( a, "n" ) ||
+           ( !strncmp( a, b, len ) && ( !b[len] || !strncmp( b + len, "2e", 2 ) ) );
+}
+
+// a write below skey changes data that shadows of enclosing or enclosed
+// keys mirror; drop them
+static NEOERR *DropOverlaps( HDF *prints, const char *skey )
+{
+    NEOERR *nerr = STATUS_OK;
+    HDF *node = NULL;
+    HDF *next = NULL;
+    char *name = NULL;
+    
+    for( node = hdf_obj_child( prints ); STATUS_OK == nerr && node; node = next )
+    {
+        next = hdf_obj_next( node );
+        name = hdf_obj_name( node );
+        if( strcmp( name, skey ) && ( ShadowCovers( name, skey ) || ShadowCovers( skey, name ) ) ){
+            nerr = hdf_remove_tree( prints, name );
+        }
+    }
+    
+    return nerr_pass( nerr );
+}
+
+// set obj below key like _setObject, writing only what changed since
+// the last diff mode call with the same key
+Handle<Value> ClearSilver::_diffObject( ParseCtx_t *ctx, const char *key, Local<Object> obj )
+{
+    Handle<Value> retval = Undefined();
+    Local<Array> props = obj->GetPropertyNames();
+    NEOERR *nerr = STATUS_OK;
+    ConvBuf_t conv = { NULL, 0, false };
+    Prints_t prints = { NULL, 0, 0 };
+    Ancestors_t path;
+    HDF *hdf = ctx->hdf;
+    HDF *shadow = NULL;
+    char *skey = NULL;
+    char *estr = NULL;
+    uint32_t cursor = 0;
+    
+    if( !props->Length() ){
+        return retval;
+    }
+    
+    memset( &path, 0, sizeof( Ancestors_t ) );
+    // shadow trees of unkeyed and keyed calls are kept apart
+    if( !( skey = ShadowKey( key ) ) ){
+        nerr = nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+    }
+    else if( ( !ctx->prints && STATUS_OK != ( nerr = hdf_init( &ctx->prints ) ) ) ||
+             STATUS_OK != ( nerr = hdf_get_node( ctx->prints, skey, &shadow ) ) ||
+             ( key && *key && STATUS_OK != ( nerr = hdf_get_node( hdf, key, &hdf ) ) ) ){
+        // error
+    }
+    else if( !PushAncestor( &path, obj, obj->GetIdentityHash() ) ){
+        nerr = nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+    }
+    else if( STATUS_OK == ( nerr = _fingerprint( obj, props, &conv, &path, &prints ) ) )
+    {
+        char hex[17];
+        char *cur = hdf_obj_value( shadow );
+        
+        snprintf( hex, sizeof( hex ), "%016llx", (unsigned long long)prints.list[0].hash );
+        if( ( !cur || strcmp( cur, hex ) ) &&
+            STATUS_OK == ( nerr = DropOverlaps( ctx->prints, skey ) ) &&
+            STATUS_OK == ( nerr = _diffValue( hdf, shadow, obj, props, &conv, &path, &prints, &cursor ) ) ){
+            nerr = hdf_set_value( shadow, NULL, hex );
+        }
+    }
+    
+    if( conv.removed ){
+        ctx->generation++;
+    }
+    // shadow may not match hdf anymore
+    if( STATUS_OK != nerr && ctx->prints ){
+        hdf_destroy( &ctx->prints );
+    }
+    if( ( estr = CHECK_NEOERR( nerr ) ) ){
+        retval = ThrowException( Exception::Error( String::New( estr ) ) );
+        free(estr);
+    }
+    free( skey );
+    delete[] path.objs;
+    free( path.hashes );
+    free( prints.list );
+    free( conv.buf );
+    
+    return retval;
+}
+
+// setValue( parser_id:String, key:[String|Undefined|Null], val, [options:Object] )
+//  options.diff: write only the parts of an Object/Array val that changed
+//  since the last diff call with the same key, and remove keys that are
+//  gone. any other setValue or removeValue resets the diff state.
+Handle<Value> ClearSilver::setValue( const Arguments& argv )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    Handle<Value> retval = Null();
+    const int argc = argv.Length();
+    ParseCtx_t *ctx = NULL;
+    
+    // invalid arguments
+    if( 3 > argc || !argv[0]->IsString() ){
+        retval = ThrowException( Exception::TypeError( String::New( "setValue( parser_id:String, key:[String|Undefined|Null], val:[String|Number|Date|Boolean|Array|Object] )" ) ) );
+    }
+    // find parser
+    else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)*String::Utf8Value( argv[0] ) ) ) ){
+        retval = ThrowException( Exception::ReferenceError( String::New( "faild to setValue: parser not found" ) ) );
+    }
+    else if( ( errno = pthread_rwlock_wrlock( &ctx->lock ) ) ){
+        retval = ThrowException( Exception::Error( String::New( strerror(errno) ) ) );
+    }
+    else
+    {
+        uint32_t valType = TypeOf( argv[2] );
+        bool diff = ( 3 < argc && argv[3]->IsObject() &&
+                      argv[3]->ToObject()->Get( String::NewSymbol("diff") )->BooleanValue() );
+        
+        if( ctx->prints && !( diff && valType & isRecursive ) ){
+            hdf_destroy( &ctx->prints );
+        }
+        ctx->version++;
+        
+        if( valType & isPrintable )
+        {
+            char *estr = NULL;
+            
+            if( !argv[1]->IsString() ){
+                retval = ThrowException( Exception::TypeError( String::New( "setValue( parser_id:String, key:String, val:[String|Number|Date|Boolean] )" ) ) );
+            }
+            // Date milliseconds to iso8601
+            else if( valType & JS_TYPE_DATE_BIT ){
+                char iso8601[ISO8601_STRING_LEN];
+                MSEC_TO_ISO8601( iso8601, argv[2]->IntegerValue() );
+                estr = CHECK_NEOERR( hdf_set_value( ctx->hdf, *String::Utf8Value( argv[1] ), iso8601 ) );
+            }
+            else if( valType & JS_TYPE_BOOLEAN_BIT ){
+                estr = CHECK_NEOERR( hdf_set_int_value( ctx->hdf, *String::Utf8Value( argv[1] ), ( argv[2]->BooleanValue() ) ? 1 : 0 ) );
+            }
+            else {
+                estr = CHECK_NEOERR( hdf_set_value( ctx->hdf, *String::Utf8Value( argv[1] ), *String::Utf8Value( argv[2] ) ) );
+            }
+            
+            if( estr ){
+                retval = ThrowException( Exception::Error( String::New( estr ) ) );
+                free(estr);
+            }
+        }
+        else if( valType & isRecursive && diff ){
+            retval = _diffObject( ctx, ( !argv[1]->IsString() ) ? "" : *String::Utf8Value( argv[1] ), argv[2]->ToObject() );
+        }
+        else if( valType & isRecursive )
+        {
+            bool removed = false;
+            
+            retval = _setObject( ctx->hdf, ( !argv[1]->IsString() ) ? "" : *String::Utf8Value( argv[1] ), argv[2]->ToObject(), &removed );
+            if( removed ){
+                ctx->generation++;
+            }
+        }
+        pthread_rwlock_unlock( &ctx->lock );
+    }
+    
+    return scope.Close( retval->IsNull() ? Handle<Value>() : retval );
+}
+
+Handle<Value> ClearSilver::getValue( const Arguments &argv )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    const int argc = argv.Length();
+    Handle<Value> retval = Undefined();
+    ParseCtx_t *ctx = NULL;
+    
+    // invalid arguments
+    if( 2 > argc || !argv[0]->IsString() || !argv[1]->IsString() ){
+        retval = ThrowException( Exception::TypeError( String::New( "removeValue( parser_id:String, key:String )" ) ) );
+    }
+    // find parser
+    else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)*String::Utf8Value( argv[0] ) ) ) ){
+        retval = ThrowException( Exception::ReferenceError( String::New( "faild to removeValue: parser not found" ) ) );
+    }
+    else if( ( errno = pthread_rwlock_rdlock( &ctx->lock ) ) ){
+        retval = ThrowException( Exception::Error( String::New( strerror(errno) ) ) );
+    }
+    else
+    {
+        char *val = hdf_get_value( ctx->hdf, *String::Utf8Value( argv[1] ), NULL );
+        if( val ){
+            retval = String::New( val );
+        }
+        pthread_rwlock_unlock( &ctx->lock );
+    }
+    
+    return scope.Close( retval );
+}
+
+Handle<Value> ClearSilver::removeValue( const Arguments &argv )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    const int argc = argv.Length();
+    Handle<Value> retval = Undefined();
+    ParseCtx_t *ctx = NULL;
+    
+    // invalid arguments
+    if( 2 > argc || !argv[0]->IsString() || !argv[1]->IsString() ){
+        retval = ThrowException( Exception::TypeError( String::New( "removeValue( parser_id:String, key:String )" ) ) );
+    }
+    // find parser
+    else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)*String::Utf8Value( argv[0] ) ) ) ){
+        retval = ThrowException( Exception::ReferenceError( String::New( "faild to removeValue: parser not found" ) ) );
+    }
+    else if( ( errno = pthread_rwlock_wrlock( &ctx->lock ) ) ){
+        retval = ThrowException( Exception::Error( String::New( strerror(errno) ) ) );
+    }
+    else
+    {
+        char *estr = NULL;
+        
+        if( ctx->prints ){
+            hdf_destroy( &ctx->prints );
+        }
+        ctx->generation++;
+        ctx->version++;
+        if( ( estr = CHECK_NEOERR( hdf_remove_tree( ctx->hdf, *String::Utf8Value( argv[1] ) ) ) ) ){
+            retval = ThrowException( Exception::ReferenceError( String::New( estr ) ) );
+            free(estr);
+        }
+        pthread_rwlock_unlock( &ctx->lock );
+    }
+    
+    return scope.Close( retval );
+}
+
+Handle<Value> ClearSilver::dump( const Arguments &argv )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    const int argc = argv.Length();
+    Handle<Value> retval = Undefined();
+    ParseCtx_t *ctx = NULL;
+    
+    // invalid arguments
+    if( !argv[0]->IsString() ){
+        retval = ThrowException( Exception::TypeError( String::New( "dump( parser_id:String )" ) ) );
+    }
+    // find parser
+    else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)*String::Utf8Value( argv[0] ) ) ) ){
+        retval = ThrowException( Exception::ReferenceError( String::New( "faild to dump: parser not found" ) ) );
+    }
+    else if( ( errno = pthread_rwlock_rdlock( &ctx->lock ) ) ){
+        retval = ThrowException( Exception::Error( String::New( strerror(errno) ) ) );
+    }
+    else
+    {
+        char *estr = NULL;
+        STRING dump;
+        
+        string_init(&dump);
+        estr = CHECK_NEOERR( hdf_dump_str(ctx->hdf, NULL, 2, &dump) );
+        pthread_rwlock_unlock( &ctx->lock );
+        if( estr ){
+            retval = ThrowException( Exception::ReferenceError( String::New( estr ) ) );
+            free(estr);
+        }
+        else {
+            retval = String::New( dump.buf );
+        }
+        string_clear(&dump);
+    }
+    
+    return scope.Close( retval );
+}
+
+
+// MARK: stats
+static Local<Object> StatsToObject( Stats_t *stats )
+{
+    Local<Object> obj = Object::New();
+    Local<Array> hist = Array::New( STATS_HIST_BUCKETS );
+    
+    obj->Set( String::NewSymbol("parses"), Number::New( stats->parses ) );
+    obj->Set( String::NewSymbol("parseTime"), Number::New( stats->parseTime ) );
+    obj->Set( String::NewSymbol("parseTimeLast"), Number::New( stats->parseTimeLast ) );
+    obj->Set( String::NewSymbol("renders"), Number::New( stats->renders ) );
+    obj->Set( String::NewSymbol("renderErrors"), Number::New( stats->renderErrors ) );
+    obj->Set( String::NewSymbol("renderTime"), Number::New( stats->renderTime ) );
+    obj->Set( String::NewSymbol("renderTimeMax"), Number::New( stats->renderTimeMax ) );
+    obj->Set( String::NewSymbol("outputBytes"), Number::New( stats->outputBytes ) );
+    obj->Set( String::NewSymbol("lockWait"), Number::New( stats->lockWait ) );
+    obj->Set( String::NewSymbol("includeHits"), Number::New( stats->includeHits ) );
+    obj->Set( String::NewSymbol("includeMisses"), Number::New( stats->includeMisses ) );
+    for( uint32_t i = 0; i < STATS_HIST_BUCKETS; i++ ){
+        hist->Set( i, Number::New( stats->hist[i] ) );
+    }
+    obj->Set( String::NewSymbol("histogram"), hist );
+    
+    return obj;
+}
+
+// stats( [parser_id:String] )
+//  times are in microseconds; histogram[i] counts renders that took
+//  [2^i, 2^(i+1)) usec, the last bucket everything above.
+//  without parser_id: { parser_id: stats, ... } of all parsers
+Handle<Value> ClearSilver::stats( const Arguments &argv )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    Handle<Value> retval = Undefined();
+    ParseCtx_t *ctx = NULL;
+    
+    // invalid arguments
+    if( 0 < argv.Length() && IsDefined( argv[0] ) && !argv[0]->IsString() ){
+        retval = ThrowException( Exception::TypeError( String::New( "stats( [parser_id:String] )" ) ) );
+    }
+    else if( 0 < argv.Length() && argv[0]->IsString() )
+    {
+        if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)*String::Utf8Value( argv[0] ) ) ) ){
+            retval = ThrowException( Exception::ReferenceError( String::New( "faild to stats: parser not found" ) ) );
+        }
+        else {
+            retval = StatsToObject( &ctx->stats );
+        }
+    }
+    else
+    {
+        Local<Object> all = Object::New();
+        void *key = NULL;
+        
+        while( ( ctx = (ParseCtx_t*)ne_hash_next( cs->parseCache, &key ) ) ){
+            all->Set( String::New( ctx->id ), StatsToObject( &ctx->stats ) );
+        }
+        retval = all;
+    }
+    
+    return scope.Close( retval );
+}
+
+// resetStats( [parser_id:String] )
+//  counters updated by renders in progress may survive the reset
+Handle<Value> ClearSilver::resetStats( const Arguments &argv )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    Handle<Value> retval = Undefined();
+    ParseCtx_t *ctx = NULL;
+    
+    // invalid arguments
+    if( 0 < argv.Length() && IsDefined( argv[0] ) && !argv[0]->IsString() ){
+        retval = ThrowException( Exception::TypeError( String::New( "resetStats( [parser_id:String] )" ) ) );
+    }
+    else if( 0 < argv.Length() && argv[0]->IsString() )
+    {
+        if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)*String::Utf8Value( argv[0] ) ) ) ){
+            retval = ThrowException( Exception::ReferenceError( String::New( "faild to resetStats: parser not found" ) ) );
+        }
+        else {
+            memset( &ctx->stats, 0, sizeof( Stats_t ) );
+        }
+    }
+    else
+    {
+        void *key = NULL;
+        
+        while( ( ctx = (ParseCtx_t*)ne_hash_next( cs->parseCache, &key ) ) ){
+            memset( &ctx->stats, 0, sizeof( Stats_t ) );
+        }
+    }
+    
+    return scope.Close( retval );
+}
+
+// MARK: node handle
+Persistent<FunctionTemplate> HDFNode::constructor_template;
+
+HDFNode::~HDFNode()
+{
+    free( id );
+    free( key );
+}
+
+Handle<Value> HDFNode::New( const Arguments &argv )
+{
+    HandleScope scope;
+    HDFNode *handle = new HDFNode();
+    
+    handle->id = handle->key = NULL;
+    handle->serial = handle->generation = 0;
+    handle->node = NULL;
+    handle->Wrap( argv.This() );
+    
+    return scope.Close( argv.This() );
+}
+
+void HDFNode::Initialize( Handle<Object> target )
+{
+    HandleScope scope;
+    Local<FunctionTemplate> t = FunctionTemplate::New( New );
+    
+    t->InstanceTemplate()->SetInternalFieldCount(1);
+    t->SetClassName( String::NewSymbol("HDFNode") );
+    constructor_template = Persistent<FunctionTemplate>::New( t );
+    target->Set( String::NewSymbol("HDFNode"), t->GetFunction() );
+}
+
+// node of handle; resolved again if stale. without create, *node is
+// NULL for a missing key. call with ctx->lock held, write lock to create
+NEOERR *ClearSilver::_resolveNode( ParseCtx_t *ctx, HDFNode *handle, bool create, HDF **node )
+{
+    NEOERR *nerr = STATUS_OK;
+    
+    if( handle->node && handle->serial == ctx->serial && handle->generation == ctx->generation ){
+        *node = handle->node;
+        return STATUS_OK;
+    }
+    
+    *node = NULL;
+    if( !*handle->key ){
+        *node = ctx->hdf;
+    }
+    else if( create ){
+        nerr = hdf_get_node( ctx->hdf, handle->key, node );
+    }
+    else {
+        *node = hdf_get_obj( ctx->hdf, handle->key );
+    }
+    
+    if( *node ){
+        handle->node = *node;
+        handle->serial = ctx->serial;
+        handle->generation = ctx->generation;
+    }
+    
+    return nerr_pass( nerr );
+}
+
+// node:HDFNode resolveNode( parser_id:String, key:String )
+//  key is resolved once; setNodeValue and getNodeValue on the returned
+//  handle skip parsing and walking the key path
+Handle<Value> ClearSilver::resolveNode( const Arguments &argv )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    Handle<Value> retval = Undefined();
+    ParseCtx_t *ctx = NULL;
+    
+    // invalid arguments
+    if( 2 > argv.Length() || !argv[0]->IsString() || !argv[1]->IsString() ){
+        retval = ThrowException( Exception::TypeError( String::New( "resolveNode( parser_id:String, key:String )" ) ) );
+    }
+    // find parser
+    else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)*String::Utf8Value( argv[0] ) ) ) ){
+        retval = ThrowException( Exception::ReferenceError( String::New( "faild to resolveNode: parser not found" ) ) );
+    }
+    else
+    {
+        Local<Object> obj = HDFNode::constructor_template->GetFunction()->NewInstance();
+        HDFNode *handle = ObjectUnwrap( HDFNode, obj );
+        
+        if( !( handle->id = strdup( ctx->id ) ) || !( handle->key = strdup( *String::Utf8Value( argv[1] ) ) ) ){
+            retval = ThrowException( Exception::Error( String::New( strerror(errno) ) ) );
+        }
+        else {
+            retval = obj;
+        }
+    }
+    
+    return scope.Close( retval );
+}
+
+// setNodeValue( node:HDFNode, val:[String|Number|Date|Boolean|Array|Object] )
+//  a printable val is set to the node itself, properties of an object
+//  are set relative to the node
+Handle<Value> ClearSilver::setNodeValue( const Arguments &argv )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    Handle<Value> retval = Undefined();
+    HDFNode *handle = NULL;
+    ParseCtx_t *ctx = NULL;
+    uint32_t valType = ( 1 < argv.Length() ) ? TypeOf( argv[1] ) : 0;
+    
+    // invalid arguments
+    if( !( valType & ( isPrintable|isRecursive ) ) || !argv[0]->IsObject() ||
+        !HDFNode::constructor_template->HasInstance( argv[0] ) ){
+        retval = ThrowException( Exception::TypeError( String::New( "setNodeValue( node:HDFNode, val:[String|Number|Date|Boolean|Array|Object] )" ) ) );
+    }
+    // find parser
+    else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)( handle = ObjectUnwrap( HDFNode, argv[0]->ToObject() ) )->id ) ) ){
+        retval = ThrowException( Exception::ReferenceError( String::New( "faild to setNodeValue: parser not found" ) ) );
+    }
+    else if( ( errno = pthread_rwlock_wrlock( &ctx->lock ) ) ){
+        retval = ThrowException( Exception::Error( String::New( strerror(errno) ) ) );
+    }
+    else
+    {
+        NEOERR *nerr = STATUS_OK;
+        HDF *node = NULL;
+        char *estr = NULL;
+        
+        if( ctx->prints ){
+            hdf_destroy( &ctx->prints );
+        }
+        ctx->version++;
+        if( STATUS_OK != ( nerr = _resolveNode( ctx, handle, true, &node ) ) ){
+            // error
+        }
+        else if( valType & isPrintable )
+        {
+            ConvBuf_t conv = { NULL, 0, false };
+            char *str = ConvLeaf( &conv, 0, argv[1], valType );
+            
+            if( !str ){
+                nerr = nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+            }
+            else {
+                // empty name sets the node itself
+                nerr = hdf_set_value( node, NULL, str );
+            }
+            free( conv.buf );
+        }
+        else
+        {
+            bool removed = false;
+            
+            retval = _setObject( node, NULL, argv[1]->ToObject(), &removed );
+            if( removed ){
+                ctx->generation++;
+            }
+        }
+        pthread_rwlock_unlock( &ctx->lock );
+        
+        if( ( estr = CHECK_NEOERR( nerr ) ) ){
+            retval = ThrowException( Exception::Error( String::New( estr ) ) );
+            free(estr);
+        }
+    }
+    
+    return scope.Close( retval );
+}
+
+// getNodeValue( node:HDFNode, [key:String] )
+//  value of the node, or of key relative to it
+Handle<Value> ClearSilver::getNodeValue( const Arguments &argv )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    const int argc = argv.Length();
+    Handle<Value> retval = Undefined();
+    HDFNode *handle = NULL;
+    ParseCtx_t *ctx = NULL;
+    
+    // invalid arguments
+    if( 1 > argc || !argv[0]->IsObject() || !HDFNode::constructor_template->HasInstance( argv[0] ) ||
+        ( 1 < argc && IsDefined( argv[1] ) && !argv[1]->IsString() ) ){
+        retval = ThrowException( Exception::TypeError( String::New( "getNodeValue( node:HDFNode, [key:String] )" ) ) );
+    }
+    // find parser
+    else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)( handle = ObjectUnwrap( HDFNode, argv[0]->ToObject() ) )->id ) ) ){
+        retval = ThrowException( Exception::ReferenceError( String::New( "faild to getNodeValue: parser not found" ) ) );
+    }
+    else if( ( errno = pthread_rwlock_rdlock( &ctx->lock ) ) ){
+        retval = ThrowException( Exception::Error( String::New( strerror(errno) ) ) );
+    }
+    else
+    {
+        HDF *node = NULL;
+        char *val = NULL;
+        
+        // lookup only; never fails
+        _resolveNode( ctx, handle, false, &node );
+        if( node ){
+            val = ( 1 < argc && argv[1]->IsString() ) ?
+                  hdf_get_value( node, *String::Utf8Value( argv[1] ), NULL ) :
+                  hdf_obj_value( node );
+        }
+        if( val ){
+            retval = String::New( val );
+        }
+        pthread_rwlock_unlock( &ctx->lock );
+    }
+    
+    return scope.Close( retval );
+}
+
+// MARK: global HDF
+// take a reference to the frozen copy of the parser HDF; call with
+// ctx->lock held, so hdf and version stand still. overlay renders share
+// one copy until the parser is written.
+static NEOERR *AcquireFrozen( ParseCtx_t *ctx, Global_t **frozen )
+{
+    NEOERR *nerr = STATUS_OK;
+    Global_t *fresh = NULL;
+    int rc = 0;
+    
+    *frozen = NULL;
+    if( ( rc = pthread_mutex_lock( &ctx->frozenLock ) ) ){
+        return nerr_raise( NERR_LOCK, "Lock failed: %s", strerror(rc) );
+    }
+    else if( !ctx->frozen || ctx->frozen->version != ctx->version )
+    {
+        if( !( fresh = (Global_t*)calloc( 1, sizeof( Global_t ) ) ) ){
+            nerr = nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+        }
+        else if( STATUS_OK != ( nerr = hdf_init( &fresh->hdf ) ) ||
+                 STATUS_OK != ( nerr = MergeHDF( fresh->hdf, ctx->hdf ) ) ){
+            hdf_destroy( &fresh->hdf );
+            free( fresh );
+        }
+        else {
+            fresh->refs = 1;
+            fresh->version = ctx->version;
+            ReleaseGlobal( ctx->frozen );
+            ctx->frozen = fresh;
+        }
+    }
+    
+    if( STATUS_OK == nerr ){
+        __sync_add_and_fetch( &ctx->frozen->refs, 1 );
+        *frozen = ctx->frozen;
+    }
+    pthread_mutex_unlock( &ctx->frozenLock );
+    
+    return nerr_pass( nerr );
+}
+
+// true if hdf has no data of its own besides Config
+static inline bool IsBareHDF( HDF *hdf )
+{
+    HDF *child = NULL;
+    
+    for( child = hdf_obj_child( hdf ); child; child = hdf_obj_next( child ) )
+    {
+        if( strcmp( hdf_obj_name( child ), "Config" ) ){
+            return false;
+        }
+    }
+    return true;
+}
+
+// request data of a render with the parser HDF folded in underneath, so
+// one fallback is left for the global HDF
+static NEOERR *FoldOverlay( HDF *parser, HDF *overlay, HDF **fold )
+{
+    NEOERR *nerr = STATUS_OK;
+    
+    if( STATUS_OK != ( nerr = hdf_init( fold ) ) ||
+        STATUS_OK != ( nerr = MergeHDF( *fold, parser ) ) ||
+        STATUS_OK != ( nerr = MergeHDF( *fold, overlay ) ) ){
+        hdf_destroy( fold );
+    }
+    
+    return nerr_pass( nerr );
+}
+
+// setGlobal( data:[Object|Null] )
+//  replace the read-only HDF that lookups of every parser fall through
+//  to; renders in progress finish with the one they started with.
+//  lookups of a render with data go to its data, then the parser HDF,
+//  then the global HDF; the first that has the name wins.
+Handle<Value> ClearSilver::setGlobal( const Arguments &argv )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    Handle<Value> retval = Undefined();
+    Global_t *global = NULL;
+    char *estr = NULL;
+    int rc = 0;
+    
+    // invalid arguments
+    if( 1 > argv.Length() || !( argv[0]->IsNull() || ( argv[0]->IsObject() && TypeOf( argv[0] ) & isRecursive ) ) ){
+        return ThrowException( Exception::TypeError( String::New( "setGlobal( data:[Object|Null] )" ) ) );
+    }
+    else if( !argv[0]->IsNull() )
+    {
+        if( !( global = (Global_t*)calloc( 1, sizeof( Global_t ) ) ) ){
+            return ThrowException( Exception::Error( String::New( strerror(errno) ) ) );
+        }
+        else if( ( estr = CHECK_NEOERR( hdf_init( &global->hdf ) ) ) ){
+            retval = ThrowException( Exception::Error( String::New( estr ) ) );
+            free( estr );
+            free( global );
+            return scope.Close( retval );
+        }
+        else if( !( retval = _setObject( global->hdf, NULL, argv[0]->ToObject() ) )->IsUndefined() ){
+            hdf_destroy( &global->hdf );
+            free( global );
+            return scope.Close( retval );
+        }
+        global->refs = 1;
+        global->version = ++GlobalVersion;
+    }
+    
+    // swap
+    if( ( rc = pthread_mutex_lock( &cs->mutex ) ) ){
+        retval = ThrowException( Exception::Error( String::New( strerror(rc) ) ) );
+        ReleaseGlobal( global );
+    }
+    else
+    {
+        Global_t *old = cs->global;
+        
+        cs->global = global;
+        pthread_mutex_unlock( &cs->mutex );
+        ReleaseGlobal( old );
+    }
+    
+    return scope.Close( retval );
+}
+
+// returns undefined on success or thrown exception
+Handle<Value> ClearSilver::_createOverlay( Handle<Value> data, HDF **overlay )
+{
+    Handle<Value> retval = Undefined();
+    char *estr = NULL;
+    
+    if( ( estr = CHECK_NEOERR( hdf_init( overlay ) ) ) ){
+        retval = ThrowException( Exception::Error( String::New( estr ) ) );
+        free(estr);
+    }
+    else if( IsDefined( data ) && !( retval = _setObject( *overlay, NULL, data->ToObject() ) )->IsUndefined() ){
+        hdf_destroy( overlay );
+    }
+    
+    return retval;
+}
+
+// Error with a code property for errors callers branch on
+static inline Local<Value> CodeError( const char *msg, const char *code )
+{
+    Local<Value> err = Exception::Error( String::New( msg ) );
+    
+    err->ToObject()->Set( String::NewSymbol("code"), String::New( code ) );
+    return err;
+}
+
+// render( parser_id:String, [data:Object], [options:Object], [callback:Function] )
+//  options follow data, or null in place of data; used by async renders:
+//  options.deadline: time in ms since epoch (Date.now()) after which the
+//                    render is dropped unstarted; callback gets an Error
+//                    with code ETIMEDOUT.
+//  options.priority: 0 (low), 1 (default) or 2 (high)
+//  a render beyond maxQueue of setRenderPool throws an Error with code
+//  EQUEUEFULL.
+Handle<Value> ClearSilver::render( const Arguments &argv )
+{
+    return _render( argv, "render", false );
+}
+
+// renderBuffer( parser_id:String, [data:Object], [options:Object], [callback:Function] )
+//  a Buffer of a cached output shares its bytes with the cache; do not
+//  write to it.
+Handle<Value> ClearSilver::renderBuffer( const Arguments &argv )
+{
+    return _render( argv, "renderBuffer", true );
+}
+
+Handle<Value> ClearSilver::_render( const Arguments &argv, const char *fname, bool buffer )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    const int argc = argv.Length();
+    Handle<Value> retval = Undefined();
+    ParseCtx_t *ctx = NULL;
+    int data = 0;
+    int opts = 0;
+    int callback = 0;
+    int next = 1;
+    uint64_t deadline = 0;
+    uint32_t priority = RENDER_PRIORITY;
+    
+    // data, options and callback are optional
+    if( 1 < argc && argv[1]->IsObject() && !argv[1]->IsFunction() ){
+        data = 1;
+    }
+    if( data || ( 2 < argc && argv[1]->IsNull() ) ){
+        next = 2;
+        if( 2 < argc && argv[2]->IsObject() && !argv[2]->IsFunction() ){
+            opts = next++;
+        }
+    }
+    if( next < argc && argv[next]->IsFunction() ){
+        callback = next;
+    }
+    
+    if( opts )
+    {
+        Local<Object> options = argv[opts]->ToObject();
+        Local<Value> val = options->Get( String::NewSymbol("deadline") );
+        
+        if( val->IsNumber() || val->IsDate() )
+        {
+            struct timeval now;
+            double remain = 0;
+            
+            gettimeofday( &now, NULL );
+            remain = val->NumberValue() - ( (double)now.tv_sec * 1000 + now.tv_usec / 1000 );
+            // already passed: queued anyway and dropped by the first worker
+            deadline = NowUsec() + ( ( 0 < remain ) ? (uint64_t)( remain * 1000 ) : 0 );
+        }
+        else if( IsDefined( val ) ){
+            opts = -1;
+        }
+        val = options->Get( String::NewSymbol("priority") );
+        if( val->IsNumber() && 0 <= val->Int32Value() && RENDER_PRIORITIES > val->Int32Value() ){
+            priority = val->Uint32Value();
+        }
+        else if( IsDefined( val ) ){
+            opts = -1;
+        }
+    }
+    
+    // invalid arguments
+    if( !argv[0]->IsString() || -1 == opts || ( next < argc && !callback && IsDefined( argv[next] ) ) ){
+        char estr[128];
+        snprintf( estr, sizeof(estr), "%s( parser_id:String, [data:Object], [options:Object], [callback:Function] )", fname );
+        retval = ThrowException( Exception::TypeError( String::New( estr ) ) );
+    }
+    // find parser
+    else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)*String::Utf8Value( argv[0] ) ) ) ){
+        char estr[128];
+        snprintf( estr, sizeof(estr), "faild to %s: parser not found", fname );
+        retval = ThrowException( Exception::ReferenceError( String::New( estr ) ) );
+    }
+    else if( !ctx->tree ){
+        char estr[128];
+        snprintf( estr, sizeof(estr), "faild to %s: parser_id does not parsed", fname );
+        retval = ThrowException( Exception::ReferenceError( String::New( estr ) ) );
+    }
+    // shed load instead of queueing renders nobody may wait for
+    else if( callback && RenderPool.maxQueue && RenderPool.pending + RenderPool.waiting >= RenderPool.maxQueue ){
+        char estr[128];
+        snprintf( estr, sizeof(estr), "faild to %s: render queue is full", fname );
+        RenderPool.rejected++;
+        retval = ThrowException( CodeError( estr, "EQUEUEFULL" ) );
+    }
+    else
+    {
+        HDF *overlay = NULL;
+        Replica_t *rep = NULL;
+        char *estr = NULL;
+        
+        // build request-local overlay
+        if( data ){
+            retval = _createOverlay( argv[data], &overlay );
+        }
+        
+        if( !retval->IsUndefined() ){
+            // exception
+        }
+        // render async
+        else if( callback )
+        {
+            Baton_t *baton = new Baton_t();
+            int rc = 0;
+            
+            baton->ctx = (void*)RetainContext( ctx );
+            baton->data = NULL;
+            baton->hdf = overlay;
+            baton->buffer = buffer;
+            baton->job.work = renderWork;
+            baton->job.done = renderDone;
+            baton->job.data = (void*)baton;
+            baton->job.priority = priority;
+            baton->job.deadline = deadline;
+            baton->job.queued = NowUsec();
+            // wait for a free replica
+            if( !( baton->rep = CheckoutReplica( ctx, false ) ) )
+            {
+                if( ctx->pendingTail ){
+                    ctx->pendingTail->next = (void*)baton;
+                }
+                else {
+                    ctx->pending = baton;
+                }
+                ctx->pendingTail = baton;
+                RenderPool.waiting++;
+            }
+            // no render worker could be started
+            else if( ( rc = RenderPoolSubmit( &baton->job ) ) )
+            {
+                retval = ThrowException( Exception::Error( String::New( strerror(rc) ) ) );
+                CheckinReplica( ctx, baton->rep );
+                if( overlay ){
+                    hdf_destroy( &overlay );
+                }
+                delete baton;
+                ReleaseContext( ctx );
+            }
+            
+            if( !rc ){
+                // detouch from GC
+                baton->callback = Persistent<Function>::New( Local<Function>::Cast( argv[callback] ) );
+                cs->Ref();
+                ev_ref(EV_DEFAULT_UC);
+            }
+        }
+        // render sync
+        else if( !( rep = CheckoutReplica( ctx, true ) ) ){
+            retval = ThrowException( Exception::Error( String::New( strerror(ENOMEM) ) ) );
+            if( overlay ){
+                hdf_destroy( &overlay );
+            }
+        }
+        else
+        {
+            // render
+            OutCache_t *hit = NULL;
+            
+            if( ( estr = CHECK_NEOERR( _render( ctx, overlay, &rep->page, callbackRender, &hit ) ) ) ){
+                retval = ThrowException( Exception::Error( String::New( estr ) ) );
+                free(estr);
+            }
+            else if( hit ){
+                retval = ( buffer ) ? OutToBuffer( hit ) : OutToString( hit );
+            }
+            else {
+                retval = ( buffer ) ? ReplicaToBuffer( rep ) : ReplicaToString( rep );
+            }
+            CheckinReplica( ctx, rep );
+            if( overlay ){
+                hdf_destroy( &overlay );
+            }
+        }
+    }
+    
+    return scope.Close( retval );
+}
+
+// call from main or other thread
+// counts output bytes of a render on the way to the real callback, and
+// keeps a copy for the output cache up to keepMax bytes
+typedef struct {
+    void *out;
+    CSOUTFUNC cb;
+    uint64_t bytes;
+    STRING *keep;
+    size_t keepMax;
+    // fallback HDF of the render, for fragments rendered by hookFileload
+    HDF *fallback;
+} RenderOut_t;
+
+// render in progress on this thread, for hookFileload
+static __thread RenderOut_t *CurrentRender = NULL;
+
+static NEOERR *CountOutput( void *ctx, char *str )
+{
+    RenderOut_t *out = (RenderOut_t*)ctx;
+    
+    if( str )
+    {
+        size_t len = strlen( str );
+        
+        out->bytes += len;
+        if( !out->keep ){
+            // not cached
+        }
+        else if( out->keepMax && out->bytes > out->keepMax ){
+            out->keep = NULL;
+        }
+        else
+        {
+            NEOERR *nerr = string_appendn( out->keep, str, len );
+            
+            if( STATUS_OK != nerr ){
+                nerr_ignore( &nerr );
+                out->keep = NULL;
+            }
+        }
+    }
+    return out->cb( out->out, str );
+}
+
+// names and values of an HDF subtree in order; names and values end
+// with their NUL, so the bytes stand for one tree only
+static NEOERR *SerializeHDF( STRING *str, HDF *hdf )
+{
+    NEOERR *nerr = STATUS_OK;
+    HDF *child = NULL;
+    const char *name = NULL;
+    const char *val = NULL;
+    
+    for( child = hdf_obj_child( hdf ); child && STATUS_OK == nerr; child = hdf_obj_next( child ) )
+    {
+        name = hdf_obj_name( child );
+        val = hdf_obj_value( child );
+        if( STATUS_OK != ( nerr = string_appendn( str, "N", 1 ) ) ||
+            STATUS_OK != ( nerr = string_appendn( str, name, strlen( name ) + 1 ) ) ||
+            ( val && ( STATUS_OK != ( nerr = string_appendn( str, "V", 1 ) ) ||
+                       STATUS_OK != ( nerr = string_appendn( str, val, strlen( val ) + 1 ) ) ) ) ){
+            break;
+        }
+        else if( hdf_obj_child( child ) &&
+                 STATUS_OK == ( nerr = string_appendn( str, "{", 1 ) ) &&
+                 STATUS_OK == ( nerr = SerializeHDF( str, child ) ) ){
+            nerr = string_appendn( str, "}", 1 );
+        }
+    }
+    
+    return nerr_pass( nerr );
+}
+
+// take canon over as the canonical data of key and fingerprint it
+static inline bool SetKeyCanon( OutCache_t *key, STRING *canon, NEOERR *nerr )
+{
+    if( STATUS_OK != nerr ){
+        nerr_ignore( &nerr );
+        string_clear( canon );
+        return false;
+    }
+    key->canon = canon->buf;
+    key->canonLen = canon->len;
+    key->hash = FNV1a64( FNV64_OFFSET, canon->buf, canon->len );
+    return true;
+}
+
+// append len bytes of data to the canonical data of key; false if out
+// of memory
+static inline bool ExtendKey( OutCache_t *key, const char *data, size_t len )
+{
+    char *canon = NULL;
+    
+    if( !len ){
+        return true;
+    }
+    else if( !( canon = (char*)realloc( key->canon, key->canonLen + len ) ) ){
+        return false;
+    }
+    memcpy( canon + key->canonLen, data, len );
+    key->canon = canon;
+    key->canonLen += len;
+    key->hash = FNV1a64( key->hash, data, len );
+    return true;
+}
+
+// serialize the frozen parser HDF once; the copy is read-only, so every
+// later key of its version reuses the bytes
+static NEOERR *FrozenCanon( ParseCtx_t *ctx, Global_t *frozen )
+{
+    NEOERR *nerr = STATUS_OK;
+    STRING canon;
+    int rc = 0;
+    
+    if( ( rc = pthread_mutex_lock( &ctx->frozenLock ) ) ){
+        return nerr_raise( NERR_LOCK, "Lock failed: %s", strerror(rc) );
+    }
+    else if( !frozen->canon )
+    {
+        string_init( &canon );
+        if( STATUS_OK == ( nerr = SerializeHDF( &canon, frozen->hdf ) ) ){
+            frozen->canon = canon.buf;
+            frozen->canonLen = canon.len;
+        }
+        else {
+            string_clear( &canon );
+        }
+    }
+    pthread_mutex_unlock( &ctx->frozenLock );
+    
+    return nerr_pass( nerr );
+}
+
+// output cache key of rendering tree with the effective data: overlay and
+// the frozen copy of the parser HDF, so only the overlay is serialized per
+// render. no lock needed. false if out of memory
+static inline bool RenderKey( OutCache_t *key, ParseCtx_t *ctx, Tree_t *tree, Global_t *global, Global_t *frozen, HDF *overlay )
+{
+    NEOERR *nerr = STATUS_OK;
+    STRING canon;
+    
+    memset( key, 0, sizeof( OutCache_t ) );
+    key->serial = ctx->serial;
+    key->version = tree->seq;
+    key->global = ( global ) ? global->version : 0;
+    string_init( &canon );
+    if( STATUS_OK == ( nerr = FrozenCanon( ctx, frozen ) ) &&
+        STATUS_OK == ( nerr = ( overlay ) ? SerializeHDF( &canon, overlay ) : STATUS_OK ) &&
+        STATUS_OK == ( nerr = string_appendn( &canon, "|", 1 ) ) && frozen->canonLen ){
+        nerr = string_appendn( &canon, frozen->canon, frozen->canonLen );
+    }
+    
+    return SetKeyCanon( key, &canon, nerr );
+}
+
+// render into cb; a cache hit is handed out in *hit instead, when given,
+// for the caller to release with ReleaseOut
+NEOERR *ClearSilver::_render( ParseCtx_t *ctx, HDF *overlay, void *out, CSOUTFUNC cb, OutCache_t **hit )
+{
+    NEOERR *nerr = STATUS_OK;
+    ClearSilver *cs = ctx->cs;
+    Global_t *global = AcquireGlobal( &cs->mutex, &cs->global );
+    Global_t *frozen = NULL;
+    HDF *fold = NULL;
+    Tree_t *tree = NULL;
+    int rc = 0;
+    // output cache
+    bool cached = ( 0 != cs->outTTL );
+    OutCache_t key;
+    OutCache_t *entry = NULL;
+    STRING page;
+    RenderOut_t counter;
+    uint64_t start = NowUsec();
+    uint64_t locked = 0;
+    
+    memset( &counter, 0, sizeof( RenderOut_t ) );
+    counter.out = out;
+    counter.cb = cb;
+    counter.keep = ( cached ) ? &page : NULL;
+    counter.keepMax = cs->outMaxBytes;
+    out = (void*)&counter;
+    cb = CountOutput;
+    string_init( &page );
+    memset( &key, 0, sizeof( OutCache_t ) );
+    
+    // overlay renders share the parser: lookups that miss the overlay fall
+    // through to the parser HDF, and <?cs set ?> writes into the overlay.
+    // they read a frozen copy of it, so the lock is only held to take one
+    // and writers never wait for a render.
+    if( overlay )
+    {
+        if( ( rc = pthread_rwlock_rdlock( &ctx->lock ) ) ){
+            nerr = nerr_raise( NERR_LOCK, "Lock failed: %s", strerror(rc) );
+        }
+        else
+        {
+            locked = NowUsec();
+            tree = AcquireTree( &ctx->treeLock, &ctx->tree );
+            nerr = AcquireFrozen( ctx, &frozen );
+            pthread_rwlock_unlock( &ctx->lock );
+        }
+        
+        if( frozen && cached && ( cached = RenderKey( &key, ctx, tree, global, frozen, overlay ) ) ){
+            entry = cs->_outAcquire( &key );
+        }
+        // the global HDF is the fallback; a parser with data of its own is
+        // copied under the overlay instead
+        if( frozen && !entry && global && !IsBareHDF( frozen->hdf ) ){
+            nerr = FoldOverlay( frozen->hdf, overlay, &fold );
+        }
+        if( frozen && !entry && STATUS_OK == nerr )
+        {
+            // cs_render keeps output, locals and escaping state in CSPARSE,
+            // so every render works on its own shallow copy; the compiled
+            // tree itself is only read.
+            CSPARSE csp = *tree->csp;
+            
+            csp.hdf = ( fold ) ? fold : overlay;
+            csp.global_hdf = ( global ) ? global->hdf : frozen->hdf;
+            csp.locals = NULL;
+            counter.fallback = csp.global_hdf;
+            CurrentRender = &counter;
+            ParserHDF = frozen->hdf;
+            nerr = cs_render( &csp, out, cb );
+            ParserHDF = NULL;
+            CurrentRender = NULL;
+        }
+    }
+    // without overlay the template may write the parser HDF
+    else if( ( rc = pthread_rwlock_wrlock( &ctx->lock ) ) ){
+        nerr = nerr_raise( NERR_LOCK, "Lock failed: %s", strerror(rc) );
+    }
+    else {
+        locked = NowUsec();
+        tree = AcquireTree( &ctx->treeLock, &ctx->tree );
+        // keyed on the frozen copy too, so a parser unwritten since the
+        // last miss is not serialized again
+        if( cached && STATUS_OK == ( nerr = AcquireFrozen( ctx, &frozen ) ) &&
+            ( cached = RenderKey( &key, ctx, tree, global, frozen, NULL ) ) ){
+            entry = cs->_outAcquire( &key );
+        }
+        if( !entry && STATUS_OK == nerr ){
+            // <?cs set ?> writes the parser HDF
+            ctx->version++;
+            tree->csp->global_hdf = counter.fallback = ( global ) ? global->hdf : NULL;
+            CurrentRender = &counter;
+            nerr = cs_render( tree->csp, out, cb );
+            CurrentRender = NULL;
+            tree->csp->global_hdf = NULL;
+        }
+        pthread_rwlock_unlock( &ctx->lock );
+    }
+    ReleaseTree( tree );
+    if( fold ){
+        hdf_destroy( &fold );
+    }
+    ReleaseGlobal( frozen );
+    ReleaseGlobal( global );
+    
+    // cache hit skips cs_render; a miss keeps the output for the next one
+    if( entry )
+    {
+        counter.bytes = entry->len;
+        if( hit ){
+            *hit = entry;
+        }
+        else {
+            nerr = ( entry->data ) ? counter.cb( counter.out, entry->data ) : STATUS_OK;
+            ReleaseOut( entry );
+        }
+    }
+    else if( locked && cached && counter.keep && STATUS_OK == nerr ){
+        cs->_outStore( &key, &page, cs->outTTL );
+    }
+    free( key.canon );
+    string_clear( &page );
+    
+    if( locked ){
+        __sync_add_and_fetch( &ctx->stats.lockWait, locked - start );
+        StatRender( &ctx->stats, NowUsec() - locked, counter.bytes, STATUS_OK != nerr );
+    }
+    
+    return nerr;
+}
+
+void ClearSilver::renderWork( void *data )
+{
+    Baton_t *baton = static_cast<Baton_t*>( data );
+    ParseCtx_t *ctx = (ParseCtx_t*)baton->ctx;
+    
+    // result stays in the replica until renderDone
+    baton->nerr = _render( ctx, baton->hdf, &baton->rep->page, callbackRender, &baton->hit );
+}
+
+void ClearSilver::renderDone( void *data )
+{
+    HandleScope scope;
+    Baton_t *baton = static_cast<Baton_t*>( data );
+    ParseCtx_t *ctx = (ParseCtx_t*)baton->ctx;
+    Handle<Primitive> t = Undefined();
+    Local<Value> argv[] = {
+        reinterpret_cast<Local<Value>&>(t),
+        reinterpret_cast<Local<Value>&>(t)
+    };
+    
+    ev_unref(EV_DEFAULT_UC);
+    ctx->cs->Unref();
+    
+    if( baton->job.expired ){
+        argv[0] = CodeError( "faild to render: deadline exceeded", "ETIMEDOUT" );
+    }
+    else if( STATUS_OK == baton->nerr && baton->hit ){
+        argv[1] = ( baton->buffer ) ? OutToBuffer( baton->hit ) : OutToString( baton->hit );
+        baton->hit = NULL;
+    }
+    else if( STATUS_OK == baton->nerr ){
+        argv[1] = ( baton->buffer ) ? ReplicaToBuffer( baton->rep ) : ReplicaToString( baton->rep );
+    }
+    else {
+        const char *errstr = CHECK_NEOERR( baton->nerr );
+        baton->nerr = STATUS_OK;
+        argv[0] = Exception::Error( String::New( errstr ) );
+        free( (void*)errstr );
+    }
+    
+    // hand the replica over to the next waiting render
+    if( ctx->pending )
+    {
+        Baton_t *next = ctx->pending;
+        
+        if( !( ctx->pending = (Baton_t*)next->next ) ){
+            ctx->pendingTail = NULL;
+        }
+        next->next = NULL;
+        next->rep = baton->rep;
+        ReserveReplica( next->rep );
+        RenderPool.waiting--;
+        RenderPoolSubmit( &next->job );
+    }
+    else {
+        CheckinReplica( ctx, baton->rep );
+    }
+    if( baton->hdf ){
+        hdf_destroy( &baton->hdf );
+    }
+    
+    TryCatch try_catch;
+    // call js function by callback function context
+    baton->callback->Call( baton->callback, 2, argv );
+    if( try_catch.HasCaught() ){
+        FatalException(try_catch);
+    }
+    // remove callback
+    baton->callback.Dispose();
+    delete baton;
+    ReleaseContext( ctx );
+}
+
+NEOERR *ClearSilver::callbackRender( void *ctx, char *str )
+{
+    return ( str ) ? string_append( (STRING*)ctx, str ) : STATUS_OK;
+}
+
+// MARK: renderMany
+typedef struct RenderMany_t RenderMany_t;
+
+typedef struct {
+    ParseCtx_t *ctx;
+    HDF *overlay;
+    STRING page;
+    // cached output in place of page
+    OutCache_t *hit;
+    NEOERR *nerr;
+    RenderMany_t *batch;
+    Job_t job;
+} RenderItem_t;
+
+struct RenderMany_t {
+    ClearSilver *cs;
+    Persistent<Function> callback;
+    // results in input order; failed items are set on the main thread
+    Persistent<Array> results;
+    RenderItem_t *items;
+    uint32_t nitems;
+    // jobs in progress
+    uint32_t running;
+};
+
+// renderMany( items:Array, callback:Function )
+//  items: [{ parser_id:String, [data:Object] }, ...]
+//  renders run in parallel with a request-local overlay each;
+//  callback( err, results:Array ) gets a String or an Error per item.
+//  items are queued at render priority; a batch that would take the
+//  queue beyond maxQueue of setRenderPool throws EQUEUEFULL as a whole.
+Handle<Value> ClearSilver::renderMany( const Arguments &argv )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    Handle<Value> retval = Undefined();
+    
+    // invalid arguments
+    if( 2 > argv.Length() || !argv[0]->IsArray() || !argv[1]->IsFunction() ){
+        retval = ThrowException( Exception::TypeError( String::New( "renderMany( items:Array, callback:Function )" ) ) );
+    }
+    // shed load like render does for a single item
+    else if( RenderPool.maxQueue &&
+             RenderPool.pending + RenderPool.waiting + Local<Array>::Cast( argv[0] )->Length() > RenderPool.maxQueue ){
+        RenderPool.rejected++;
+        retval = ThrowException( CodeError( "faild to renderMany: render queue is full", "EQUEUEFULL" ) );
+    }
+    else
+    {
+        Local<Array> list = Local<Array>::Cast( argv[0] );
+        Local<Array> results = Array::New( list->Length() );
+        RenderMany_t *batch = new RenderMany_t();
+        Local<String> keyId = String::NewSymbol("parser_id");
+        Local<String> keyData = String::NewSymbol("data");
+        uint32_t i = 0;
+        
+        batch->cs = cs;
+        batch->nitems = list->Length();
+        // one job per item; an empty list still needs one to call back
+        batch->running = ( batch->nitems ) ? batch->nitems : 1;
+        if( !( batch->items = (RenderItem_t*)calloc( batch->running, sizeof( RenderItem_t ) ) ) ){
+            delete batch;
+            return ThrowException( Exception::Error( String::New( strerror(errno) ) ) );
+        }
+        
+        for( i = 0; i < batch->nitems; i++ )
+        {
+            RenderItem_t *item = &batch->items[i];
+            Local<Value> entry = list->Get( i );
+            Local<Value> id;
+            ParseCtx_t *ctx = NULL;
+            
+            string_init( &item->page );
+            if( !entry->IsObject() || !( id = entry->ToObject()->Get( keyId ) )->IsString() ){
+                results->Set( i, Exception::TypeError( String::New( "renderMany: item must be { parser_id:String, [data:Object] }" ) ) );
+            }
+            else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)*String::Utf8Value( id ) ) ) ){
+                results->Set( i, Exception::ReferenceError( String::New( "faild to renderMany: parser not found" ) ) );
+            }
+            else if( !ctx->tree ){
+                results->Set( i, Exception::ReferenceError( String::New( "faild to renderMany: parser_id does not parsed" ) ) );
+            }
+            else
+            {
+                TryCatch try_catch;
+                
+                // build request-local overlay
+                if( !_createOverlay( entry->ToObject()->Get( keyData ), &item->overlay )->IsUndefined() ){
+                    results->Set( i, try_catch.Exception() );
+                    item->overlay = NULL;
+                }
+                else {
+                    item->ctx = RetainContext( ctx );
+                }
+            }
+        }
+        
+        // detouch from GC
+        batch->callback = Persistent<Function>::New( Local<Function>::Cast( argv[1] ) );
+        batch->results = Persistent<Array>::New( results );
+        cs->Ref();
+        // fan out over the render pool; idle workers steal queued items
+        for( i = 0; i < batch->running; i++ )
+        {
+            RenderItem_t *item = &batch->items[i];
+            
+            item->batch = batch;
+            item->job.work = renderManyWork;
+            item->job.done = renderManyDone;
+            item->job.data = (void*)item;
+            item->job.priority = RENDER_PRIORITY;
+            ev_ref(EV_DEFAULT_UC);
+            // only fails before any worker is up; then render in place
+            if( RenderPoolSubmit( &item->job ) ){
+                renderManyWork( (void*)item );
+                renderManyDone( (void*)item );
+            }
+        }
+    }
+    
+    return scope.Close( retval );
+}
+
+void ClearSilver::renderManyWork( void *data )
+{
+    RenderItem_t *item = static_cast<RenderItem_t*>( data );
+    
+    if( item->ctx ){
+        item->nerr = _render( item->ctx, item->overlay, &item->page, callbackRender, &item->hit );
+    }
+}
+
+void ClearSilver::renderManyDone( void *data )
+{
+    HandleScope scope;
+    RenderMany_t *batch = static_cast<RenderItem_t*>( data )->batch;
+    Handle<Primitive> t = Undefined();
+    Local<Value> argv[] = {
+        reinterpret_cast<Local<Value>&>(t),
+        Local<Value>::New( batch->results )
+    };
+    uint32_t i = 0;
+    
+    ev_unref(EV_DEFAULT_UC);
+    if( --batch->running ){
+        return;
+    }
+    
+    for( i = 0; i < batch->nitems; i++ )
+    {
+        RenderItem_t *item = &batch->items[i];
+        
+        if( !item->ctx ){
+            // failed before render
+        }
+        else if( STATUS_OK != item->nerr ){
+            const char *errstr = CHECK_NEOERR( item->nerr );
+            batch->results->Set( i, Exception::Error( String::New( errstr ) ) );
+            free( (void*)errstr );
+        }
+        else if( item->hit ){
+            batch->results->Set( i, OutToString( item->hit ) );
+        }
+        else {
+            batch->results->Set( i, String::New( ( item->page.buf ) ? item->page.buf : "", item->page.len ) );
+        }
+        string_clear( &item->page );
+        if( item->overlay ){
+            hdf_destroy( &item->overlay );
+        }
+        ReleaseContext( item->ctx );
+    }
+    batch->cs->Unref();
+    
+    TryCatch try_catch;
+    // call js function by callback function context
+    batch->callback->Call( batch->callback, 2, argv );
+    if( try_catch.HasCaught() ){
+        FatalException(try_catch);
+    }
+    // remove callback
+    batch->callback.Dispose();
+    batch->results.Dispose();
+    free( batch->items );
+    delete batch;
+}
+
+// renderStream( parser_id:String, [data:Object], [chunkSize:Number] )
+//  emits "data" per chunk while rendering, then "end" or "error". a paused
+//  or slow reader stops the render once STREAM_QUEUE_MAX chunks wait for
+//  it; the stream renders a frozen copy of the parser on a thread of its
+//  own, so the parser stays writable meanwhile.
+Handle<Value> ClearSilver::renderStream( const Arguments &argv )
+{
+    HandleScope scope;
+    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
+    const int argc = argv.Length();
+    Handle<Value> retval = Undefined();
+    ParseCtx_t *ctx = NULL;
+    int data = ( 1 < argc && argv[1]->IsObject() ) ? 1 : 0;
+    int size = ( 1 + data < argc && argv[1+data]->IsNumber() ) ? 1 + data : 0;
+    
+    // invalid arguments
+    if( !argv[0]->IsString() || ( 1 + data < argc && !size && IsDefined( argv[1+data] ) ) ||
+        ( size && 1 > argv[size]->Int32Value() ) ){
+        retval = ThrowException( Exception::TypeError( String::New( "renderStream( parser_id:String, [data:Object], [chunkSize:Number] )" ) ) );
+    }
+    // find parser
+    else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)*String::Utf8Value( argv[0] ) ) ) ){
+        retval = ThrowException( Exception::ReferenceError( String::New( "faild to renderStream: parser not found" ) ) );
+    }
+    else if( !ctx->tree ){
+        retval = ThrowException( Exception::ReferenceError( String::New( "faild to renderStream: parser_id does not parsed" ) ) );
+    }
+    else
+    {
+        HDF *overlay = NULL;
+        
+        // always render on an overlay, which reads a frozen copy of the
+        // parser and holds no lock while it waits for the reader
+        if( ( retval = _createOverlay( ( data ) ? argv[data] : Null(), &overlay ) )->IsUndefined() ){
+            retval = RenderStream::Create( ctx, overlay, ( size ) ? argv[size]->Uint32Value() : STREAM_CHUNK_SIZE );
+        }
+    }
+    
+    return scope.Close( retval );
+}
+
+
+// MARK: RenderStream
+
+Persistent<FunctionTemplate> RenderStream::constructor_template;
+
+RenderStream::~RenderStream()
+{
+    while( head )
+    {
+        Chunk_t *chunk = head;
+        head = chunk->next;
+        free( chunk->buf );
+        free( chunk );
+    }
+    string_clear( &page );
+    if( nerr != STATUS_OK ){
+        free( nerr );
+    }
+    pthread_cond_destroy( &cond );
+    pthread_mutex_destroy( &mutex );
+}
+
+Handle<Value> RenderStream::New( const Arguments &argv )
+{
+    HandleScope scope;
+    RenderStream *stream = new RenderStream();
+    
+    stream->ctx = NULL;
+    stream->hdf = NULL;
+    stream->chunkSize = STREAM_CHUNK_SIZE;
+    string_init( &stream->page );
+    stream->head = stream->tail = NULL;
+    stream->nqueue = 0;
+    stream->paused = stream->aborted = stream->done = stream->ended = false;
+    stream->nerr = STATUS_OK;
+    pthread_mutex_init( &stream->mutex, NULL );
+    pthread_cond_init( &stream->cond, NULL );
+    stream->Wrap( argv.This() );
+    argv.This()->Set( String::NewSymbol("readable"), True() );
+    
+    return scope.Close( argv.This() );
+}
+
+// start rendering ctx into a new stream; overlay is owned by the stream.
+// the render runs on a detached thread, not libeio, as it may wait for
+// the reader as long as the client is slow.
+Handle<Value> RenderStream::Create( ParseCtx_t *ctx, HDF *overlay, size_t chunkSize )
+{
+    HandleScope scope;
+    Local<Object> obj = constructor_template->GetFunction()->NewInstance();
+    RenderStream *stream = ObjectUnwrap( RenderStream, obj );
+    pthread_attr_t attr;
+    pthread_t thread;
+    int rc = 0;
+    
+    stream->ctx = RetainContext( ctx );
+    stream->hdf = overlay;
+    stream->chunkSize = chunkSize;
+    
+    ev_async_init( &stream->notify, callbackAsync );
+    stream->notify.data = (void*)stream;
+    ev_async_start( EV_DEFAULT_UC, &stream->notify );
+    
+    if( ( rc = pthread_attr_init( &attr ) ) ){
+        // no thread
+    }
+    else {
+        pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+        rc = pthread_create( &thread, &attr, renderThread, (void*)stream );
+        pthread_attr_destroy( &attr );
+    }
+    if( rc ){
+        ev_async_stop( EV_DEFAULT_UC, &stream->notify );
+        hdf_destroy( &stream->hdf );
+        ReleaseContext( stream->ctx );
+        stream->ctx = NULL;
+        stream->ended = true;
+        return ThrowException( Exception::Error( String::New( strerror(rc) ) ) );
+    }
+    
+    stream->Ref();
+    ctx->cs->Ref();
+    
+    return scope.Close( obj );
+}
+
+Handle<Value> RenderStream::pause( const Arguments &argv )
+{
+    HandleScope scope;
+    RenderStream *stream = ObjectUnwrap( RenderStream, argv.This() );
+    
+    stream->paused = true;
+    
+    return scope.Close( Undefined() );
+}
+
+Handle<Value> RenderStream::resume( const Arguments &argv )
+{
+    HandleScope scope;
+    RenderStream *stream = ObjectUnwrap( RenderStream, argv.This() );
+    
+    if( stream->paused ){
+        stream->paused = false;
+        stream->flush();
+    }
+    
+    return scope.Close( Undefined() );
+}
+
+// stop rendering and drop undelivered chunks
+Handle<Value> RenderStream::destroy( const Arguments &argv )
+{
+    HandleScope scope;
+    RenderStream *stream = ObjectUnwrap( RenderStream, argv.This() );
+    
+    pthread_mutex_lock( &stream->mutex );
+    stream->aborted = true;
+    while( stream->head )
+    {
+        Chunk_t *chunk = stream->head;
+        stream->head = chunk->next;
+        free( chunk->buf );
+        free( chunk );
+    }
+    stream->tail = NULL;
+    stream->nqueue = 0;
+    pthread_cond_signal( &stream->cond );
+    pthread_mutex_unlock( &stream->mutex );
+    stream->paused = false;
+    stream->flush();
+    
+    return scope.Close( Undefined() );
+}
+
+void *RenderStream::renderThread( void *data )
+{
+    RenderStream *stream = static_cast<RenderStream*>( data );
+    
+    stream->nerr = ClearSilver::_render( stream->ctx, stream->hdf, (void*)stream, callbackRender, NULL );
+    // last partial chunk
+    if( STATUS_OK == stream->nerr && stream->page.len ){
+        stream->nerr = stream->push();
+    }
+    hdf_destroy( &stream->hdf );
+    
+    // the stream may be gone once the main thread sees done; do not touch
+    // it after the unlock
+    pthread_mutex_lock( &stream->mutex );
+    stream->done = true;
+    ev_async_send( EV_DEFAULT_UC, &stream->notify );
+    pthread_mutex_unlock( &stream->mutex );
+    
+    return NULL;
+}
+
+void RenderStream::callbackAsync( EV_P_ ev_async *watcher, int revents )
+{
+    RenderStream *stream = static_cast<RenderStream*>( watcher->data );
+    
+    (void)revents;
+    stream->flush();
+}
 
-int ClearSilver::renderBeginEIO( eio_req *req )
+// call from render thread
+NEOERR *RenderStream::callbackRender( void *ctx, char *str )
 {
-    Baton_t *baton = static_cast<Baton_t*>( req->data );
-    ParseCtx_t *ctx = (ParseCtx_t*)baton->ctx;
+    RenderStream *stream = static_cast<RenderStream*>( ctx );
+    NEOERR *nerr = STATUS_OK;
     
-    if( pthread_mutex_lock( &ctx->mutex ) ){
-        baton->nerr = nerr_raise( NERR_SYSTEM, "Mutex lock failed: %s", strerror(errno) );
-    }
-    else
-    {
-        STRING page;
-        
-        string_init(&page);
-        if( STATUS_OK == ( baton->nerr = cs_render( ctx->csp, &page, callbackRender ) ) ){
-            baton->data = malloc( page.len+1 );
-            memcpy( (void*)baton->data, (void*)page.buf, page.len );
-            ((char*)baton->data)[page.len] = 0;
-        }
-        string_clear(&page);
-        errno = 0;
-        if( pthread_mutex_unlock( &ctx->mutex ) )
-        {
-            free( baton->data );
-            if( STATUS_OK != baton->nerr ){
-                free(baton->nerr);
-            }
-            baton->nerr = nerr_raise( NERR_LOCK, "Mutex unlock failed: %s", strerror(errno) );
-        }
+    if( str && STATUS_OK == ( nerr = string_append( &stream->page, str ) ) &&
+        (size_t)stream->page.len >= stream->chunkSize ){
+        nerr = stream->push();
     }
     
-    return 0;
+    return nerr;
 }
 
-int ClearSilver::renderEndEIO( eio_req *req )
+// call from render thread: queue filled chunk and wait while the reader
+// is behind; that is where a slow client pauses the render. the render
+// holds no parser lock, so the wait only parks the stream thread.
+NEOERR *RenderStream::push( void )
 {
-    HandleScope scope;
-    Baton_t *baton = static_cast<Baton_t*>(req->data);
-    ParseCtx_t *ctx = (ParseCtx_t*)baton->ctx;
-    Handle<Primitive> t = Undefined();
-    Local<Value> argv[] = {
-        reinterpret_cast<Local<Value>&>(t),
-        reinterpret_cast<Local<Value>&>(t)
-    };
+    Chunk_t *chunk = (Chunk_t*)malloc( sizeof( Chunk_t ) );
     
-    ev_unref(EV_DEFAULT_UC);
-    ctx->cs->Unref();
+    if( !chunk ){
+        return nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+    }
+    chunk->buf = page.buf;
+    chunk->len = page.len;
+    chunk->next = NULL;
+    string_init( &page );
     
-    if( STATUS_OK == baton->nerr ){
-        argv[1] = String::New( (char*)baton->data );
-        free( baton->data );
+    pthread_mutex_lock( &mutex );
+    while( nqueue >= STREAM_QUEUE_MAX && !aborted ){
+        pthread_cond_wait( &cond, &mutex );
+    }
+    if( aborted ){
+        pthread_mutex_unlock( &mutex );
+        free( chunk->buf );
+        free( chunk );
+        return nerr_raise( NERR_IO, "render stream destroyed" );
+    }
+    if( tail ){
+        tail->next = chunk;
     }
     else {
-        const char *errstr = CHECK_NEOERR( baton->nerr );
-        baton->nerr = STATUS_OK;
-        argv[0] = Exception::Error( String::New( errstr ) );
-        free( (void*)errstr );
+        head = chunk;
     }
+    tail = chunk;
+    nqueue++;
+    pthread_mutex_unlock( &mutex );
+    ev_async_send( EV_DEFAULT_UC, &notify );
     
+    return STATUS_OK;
+}
+
+// call from main thread: deliver queued chunks unless paused, then end
+void RenderStream::flush( void )
+{
+    HandleScope scope;
+    Chunk_t *chunk = NULL;
+    bool finished = false;
     TryCatch try_catch;
-    // call js function by callback function context
-    baton->callback->Call( baton->callback, 2, argv );
-    if( try_catch.HasCaught() ){
-        FatalException(try_catch);
-    }
-    // remove callback
-    baton->callback.Dispose();
-    delete baton;
     
-    eio_cancel(req);
+    while( !paused && !ended )
+    {
+        pthread_mutex_lock( &mutex );
+        if( ( chunk = head ) )
+        {
+            if( !( head = chunk->next ) ){
+                tail = NULL;
+            }
+            nqueue--;
+            pthread_cond_signal( &cond );
+        }
+        pthread_mutex_unlock( &mutex );
+        
+        if( !chunk ){
+            break;
+        }
+        else
+        {
+            // buffer takes over the chunk memory
+            Buffer *buf = Buffer::New( chunk->buf, chunk->len, FreeBuffer, NULL );
+            Handle<Value> argv[] = { buf->handle_ };
+            
+            free( chunk );
+            Emit( String::NewSymbol("data"), 1, argv );
+            if( try_catch.HasCaught() ){
+                FatalException(try_catch);
+            }
+        }
+    }
     
-    return 0;
+    // render finished and every chunk delivered
+    pthread_mutex_lock( &mutex );
+    finished = done && !head;
+    pthread_mutex_unlock( &mutex );
+    if( finished && !ended && ( !paused || aborted ) )
+    {
+        ended = true;
+        ev_async_stop( EV_DEFAULT_UC, &notify );
+        if( aborted ){
+            Emit( String::NewSymbol("close"), 0, NULL );
+        }
+        else if( STATUS_OK != nerr )
+        {
+            const char *errstr = CHECK_NEOERR( nerr );
+            Handle<Value> argv[] = { Exception::Error( String::New( errstr ) ) };
+            
+            nerr = STATUS_OK;
+            free( (void*)errstr );
+            Emit( String::NewSymbol("error"), 1, argv );
+        }
+        else {
+            Emit( String::NewSymbol("end"), 0, NULL );
+        }
+        if( try_catch.HasCaught() ){
+            FatalException(try_catch);
+        }
+        ctx->cs->Unref();
+        ReleaseContext( ctx );
+        Unref();
+    }
 }
 
-NEOERR *ClearSilver::callbackRender( void *ctx, char *str )
+void RenderStream::Initialize( Handle<Object> target )
 {
-    return ( str ) ? string_append( (STRING*)ctx, str ) : STATUS_OK;
+    HandleScope scope;
+    Local<FunctionTemplate> t = FunctionTemplate::New( New );
+    
+    t->Inherit( EventEmitter::constructor_template );
+    t->InstanceTemplate()->SetInternalFieldCount(1);
+    t->SetClassName( String::NewSymbol("RenderStream") );
+    NODE_SET_PROTOTYPE_METHOD( t, "pause", pause );
+    NODE_SET_PROTOTYPE_METHOD( t, "resume", resume );
+    NODE_SET_PROTOTYPE_METHOD( t, "destroy", destroy );
+    constructor_template = Persistent<FunctionTemplate>::New( t );
+    target->Set( String::NewSymbol("RenderStream"), t->GetFunction() );
 }
 
-// call from main or other thread
-NEOERR *ClearSilver::hookFileload( void *context, HDF *hdf, const char *filepath, char **inject )
+// resolve filepath against Config.loadpaths; *resolve is NULL and
+// STATUS_OK is returned if no loadpath has the file
+static NEOERR *ResolvePath( HDF *paths, const char *filepath, char **resolve )
 {
     NEOERR *nerr = STATUS_OK;
-    //HandleScope scope;
-    ParseCtx_t *ctx = (ParseCtx_t*)context;
-    HDF *paths = hdf_get_child( hdf, "Config.loadpaths" );
-    char *resolve = NULL;
     char *errstr = NULL;
     
+    *resolve = NULL;
     if( !paths )
     {
-        if( !( resolve = realpath( filepath, NULL ) ) )
+        if( !( *resolve = realpath( filepath, NULL ) ) )
         {
             errstr = strerror(errno);
             switch (errno)
@@ -1005,7 +5862,7 @@ NEOERR *ClearSilver::hookFileload( void *context, HDF *hdf, const char *filepath
                     break;
                 }
                 // check errno
-                else if( !( resolve = realpath( fullpath, NULL ) ) )
+                else if( !( *resolve = realpath( fullpath, NULL ) ) )
                 {
                     errstr = strerror(errno);
                     switch (errno)
@@ -1024,13 +5881,13 @@ NEOERR *ClearSilver::hookFileload( void *context, HDF *hdf, const char *filepath
                     }
                 }
                 // found but not secure
-                else if( 0 != strncmp( loadpath, resolve, strlen( loadpath ) ) ){
+                else if( 0 != strncmp( loadpath, *resolve, strlen( loadpath ) ) ){
                     nerr = nerr_raise( NERR_SYSTEM, "%s", strerror(EACCES) );
                 }
                 free( fullpath );
                 fullpath = NULL;
                 
-                if( resolve || nerr != STATUS_OK ){
+                if( *resolve || nerr != STATUS_OK ){
                     break;
                 }
             }
@@ -1038,299 +5895,341 @@ NEOERR *ClearSilver::hookFileload( void *context, HDF *hdf, const char *filepath
         }while( ( paths = hdf_obj_next( paths ) ) );
         
         if( nerr != STATUS_OK ){
-            free(resolve);
-            resolve = NULL;
+            free(*resolve);
+            *resolve = NULL;
         }
     }
     
-    if( resolve )
+    return nerr;
+}
+
+// resolved path cache key of filepath under Config.loadpaths: every
+// loadpath prefixed by its length, then ";" and filepath. the loadpaths
+// are kept in full, so a key never stands for other loadpaths.
+static NEOERR *LoadpathsKey( HDF *paths, const char *filepath, char **key )
+{
+    NEOERR *nerr = STATUS_OK;
+    const char *val = NULL;
+    STRING str;
+    
+    *key = NULL;
+    string_init( &str );
+    for( ; paths && STATUS_OK == nerr; paths = hdf_obj_next( paths ) )
     {
-        KeyVal_t *cache = NULL;
-        
-        // cache lock
-        if( pthread_mutex_lock( &ctx->cs->mutex ) ){
-            nerr = nerr_raise( NERR_LOCK, "Mutex lock failed: %s", strerror(errno) );
-        }
-        else {
-            cache = (KeyVal_t*)ne_hash_lookup( ctx->cs->fileCache, (void*)resolve );
-        }
-        
-        // load file if no cached
-        if( !cache )
-        {
-            if( !( cache = (KeyVal_t*)calloc( 1, sizeof( KeyVal_t ) ) ) ){
-                // critical
-                nerr = nerr_raise( NERR_SYSTEM, "%s", strerror(errno) );
-            }
-            else if( -1 == asprintf( (char**)&cache->id, resolve ) ){
-                // critical
-                nerr = nerr_raise( NERR_SYSTEM, "%s", strerror(errno) );
-            }
-            else if( STATUS_OK != ( nerr = ne_load_file( resolve, (char**)&cache->data ) ) ||
-                     STATUS_OK != ( nerr = ne_hash_insert( ctx->cs->fileCache, cache->id, (void*)cache ) ) )
-            {
-                free(cache->id);
-                free(cache);
-                cache = NULL;
-            }
-            else {
-                free(resolve);
-            }
-        }
-        
-        if( STATUS_OK == nerr )
-        {
-            char *ext = rindex( (char*)cache->id, '.' );
-        
-            // is HDF
-            if( ext && !strcmp( ext, ".hdf" ) ){
-                nerr = hdf_read_string( hdf, (char*)cache->data );
-                asprintf( inject, "" );
-            }
-            // is text
-            else if( -1 == asprintf( inject, "%s", (char*)cache->data ) ){
-                // critical
-                nerr = nerr_raise( NERR_SYSTEM, "%s", strerror(errno) );
-            }
-            
-            // remove cache
-            if( STATUS_OK != nerr ){
-                ne_hash_remove( ctx->cs->fileCache, cache->id );
-                free(cache->id);
-                free(cache);
-                cache = NULL;
-            }
+        if( ( val = hdf_obj_value( paths ) ) ){
+            nerr = string_appendf( &str, "%u:%s", (unsigned)strlen( val ), val );
         }
     }
-    
-    if( !inject && -1 == asprintf( inject, "[include] failed to include %s\n", strerror(ENOENT) ) ){
-        // critical
-        nerr = nerr_raise( NERR_SYSTEM, "%s", strerror(errno) );
+    if( STATUS_OK != nerr ||
+        STATUS_OK != ( nerr = string_appendf( &str, ";%s", filepath ) ) ){
+        string_clear( &str );
+        return nerr_pass( nerr );
     }
-
-    return nerr_pass(nerr);
+    *key = str.buf;
+    
+    return STATUS_OK;
 }
 
-/*
-
-int ClearSilver::parseStringBeginEIO( eio_req *req )
+// output cache key of a fragment: declaration, file version and the
+// values of the declared HDF paths, looked up like the render does.
+// false if out of memory
+static inline bool FragmentKey( OutCache_t *key, Fragment_t *frag, FileCache_t *cache, HDF *hdf, HDF *fallback )
 {
-    Baton_t *baton = static_cast<Baton_t*>( req->data );
-    ParseCtx_t *ctx = (ParseCtx_t*)baton->ctx;
-    char *timestamp = NULL;
+    NEOERR *nerr = STATUS_OK;
+    STRING canon;
+    uint32_t i = 0;
     
-    CurrentTimestamp( &timestamp );
-    printf("  pthread_mutex_lock: %s:%s\n", ctx->id, timestamp );
-    if( pthread_mutex_lock( &ctx->mutex ) ){
-        baton->nerr = nerr_raise( NERR_SYSTEM, "Mutex lock failed: %s", strerror(errno) );
+    memset( key, 0, sizeof( OutCache_t ) );
+    key->version = frag->serial;
+    key->global = (uint32_t)cache->mtime;
+    string_init( &canon );
+    if( STATUS_OK == ( nerr = string_appendn( &canon, (const char*)&cache->mtime, sizeof( time_t ) ) ) ){
+        nerr = string_appendn( &canon, (const char*)&cache->size, sizeof( off_t ) );
     }
-    else
+    for( i = 0; STATUS_OK == nerr && i < frag->nkeys; i++ )
     {
-        printf("pthread_mutex_locked: %s:%s\n", ctx->id, timestamp );
-        if( STATUS_OK != ( baton->nerr = cs_parse_string( ctx->csp, (char*)ctx->tmpl, ctx->len ) ) )
-        {
-            // printf("ERR! %d,%d\n", NERR_SYSTEM, baton->nerr->error );
-            if( baton->nerr->error == NERR_NOT_FOUND ){
-                free(baton->nerr);
-                baton->nerr = STATUS_OK;
-            }
-        }
+        HDF *node = hdf_get_obj( hdf, frag->keys[i] );
+        const char *val = NULL;
         
-        errno = 0;
-        if( pthread_mutex_unlock( &ctx->mutex ) )
-        {
-            if( STATUS_OK != baton->nerr ){
-                free(baton->nerr);
-            }
-            baton->nerr = nerr_raise( NERR_LOCK, "Mutex unlock failed: %s", strerror(errno) );
+        if( !node && fallback ){
+            node = hdf_get_obj( fallback, frag->keys[i] );
+        }
+        if( STATUS_OK != ( nerr = string_appendn( &canon, frag->keys[i], strlen( frag->keys[i] ) + 1 ) ) ){
+            break;
+        }
+        else if( !node ){
+            nerr = string_appendn( &canon, "-", 1 );
+        }
+        else if( ( val = hdf_obj_value( node ) ) &&
+                 ( STATUS_OK != ( nerr = string_appendn( &canon, "V", 1 ) ) ||
+                   STATUS_OK != ( nerr = string_appendn( &canon, val, strlen( val ) + 1 ) ) ) ){
+            break;
+        }
+        else if( STATUS_OK == ( nerr = string_appendn( &canon, "{", 1 ) ) &&
+                 STATUS_OK == ( nerr = SerializeHDF( &canon, node ) ) ){
+            nerr = string_appendn( &canon, "}", 1 );
         }
     }
     
-    return 0;
+    return SetKeyCanon( key, &canon, nerr );
 }
 
-int ClearSilver::parseStringEndEIO( eio_req *req )
+// true if every file in deps is cached as recorded; call with mutex held.
+// a dependency out of the file cache is unknown and counts as changed.
+bool ClearSilver::_depsFresh( const char *deps, size_t len )
 {
-    HandleScope scope;
-    Baton_t *baton = static_cast<Baton_t*>(req->data);
-    ParseCtx_t *ctx = (ParseCtx_t*)baton->ctx;
-    Handle<Primitive> t = Undefined();
-    Local<Value> argv[] = {
-        reinterpret_cast<Local<Value>&>(t),
-        String::New( ctx->id )
-    };
-    
-    ev_unref(EV_DEFAULT_UC);
-    ctx->cs->Unref();
-    
-    if( STATUS_OK != baton->nerr ){
-        const char *errstr = CHECK_NEOERR( baton->nerr );
-        baton->nerr = STATUS_OK;
-        argv[0] = Exception::Error( String::New( errstr ) );
-        free( (void*)errstr );
-    }
-    else {
-        ctx->delWhenFailed = false;
-    }
+    FileCache_t *cache = NULL;
+    const char *path = NULL;
+    time_t mtime = 0;
+    off_t size = 0;
+    size_t pos = 0;
     
-    TryCatch try_catch;
-    // call js function by callback function context
-    baton->callback->Call( baton->callback, 2, argv );
-    // destroy parser
-    if( ctx->delWhenFailed ){
-        // !!!: add call destroyParser
-    }
-    if( try_catch.HasCaught() ){
-        FatalException(try_catch);
+    while( NextDep( deps, len, &pos, &path, &mtime, &size ) )
+    {
+        if( !( cache = _cacheLookup( path ) ) || cache->mtime != mtime || cache->size != size ){
+            return false;
+        }
     }
-    // remove callback
-    baton->callback.Dispose();
-    delete baton;
-
-    return 0;
+    return true;
 }
-*/
 
-
-/*Handle<Value> ClearSilver::parseString( const Arguments &argv )
+// render the fragment source in *inject on a parser of its own, so its
+// output is captured apart from the page. the parser sees hdf and
+// fallback only; locals of the including template are not there.
+// output without <?cs is kept for key and replaces *inject; the including
+// parser takes it as plain text. key is rebuilt from its first base bytes
+// with the files the render included, which become the dependencies of
+// fragment id.
+NEOERR *ClearSilver::_renderFragment( ParseCtx_t *ctx, HDF *hdf, HDF *fallback, const char *id, OutCache_t *key, size_t base, uint64_t ttl, char **inject )
 {
-    HandleScope scope;
-    ClearSilver *cs = ObjectUnwrap( ClearSilver, argv.This() );
-    const int argc = argv.Length();
-    Handle<Value> retval = Undefined();
-    unsigned int callback = 0;
-    ParseCtx_t *ctx = NULL;
+    NEOERR *nerr = STATUS_OK;
+    ClearSilver *cs = ctx->cs;
+    CSPARSE *csp = NULL;
+    STRING page;
+    FragmentDeps_t deps;
+    FragmentDeps_t *outer = FragmentDeps;
+    Fragment_t *frag = NULL;
+    char *src = strdup( *inject );
+    char *out = NULL;
+    char *copy = NULL;
+    bool keep = false;
     
-    // invalid arguments
-    if( !argv[0]->IsString() ){
-        retval = ThrowException( Exception::TypeError( String::New( "parseString( template:String, [parser_id:String], [callback:Function] )" ) ) );
+    string_init( &page );
+    string_init( &deps.deps );
+    deps.failed = false;
+    if( !src ){
+        return nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
     }
-    // arguments has parser_id and callback
-    else if( 2 < argc )
+    else if( STATUS_OK != ( nerr = cs_init( &csp, hdf ) ) ||
+             STATUS_OK != ( nerr = RegisterFunctions( csp ) ) ){
+        free( src );
+    }
+    else
     {
-        // invalid arguments
-        if( !argv[1]->IsString() || !argv[2]->IsFunction() ){
-            retval = ThrowException( Exception::TypeError( String::New( "parseString( template:String, [parser_id:String], [callback:Function] )" ) ) );
-        }
-        // find parser
-        else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)*String::Utf8Value( argv[1] ) ) ) ){
-            retval = ThrowException( Exception::ReferenceError( String::New( "faild to parseString: parser not found" ) ) );
-        }
-        else {
-            callback = 2;
+        csp->global_hdf = fallback;
+        cs_register_fileload( csp, (void*)ctx, hookFileload );
+        // includes are parsed with cs_parse_string, so they are collected
+        // while parsing as well as while rendering
+        FragmentDeps = &deps;
+        // csparse takes over src
+        if( STATUS_OK == ( nerr = cs_parse_string( csp, src, strlen( src ) ) ) ){
+            nerr = cs_render( csp, &page, callbackRender );
         }
+        FragmentDeps = outer;
+    }
+    if( csp ){
+        cs_destroy( &csp );
     }
-    // arguments has parser_id or callback
-    else if( 1 < argc )
+    // the including fragment depends on what this one included
+    if( outer ){
+        MergeDeps( outer, deps.deps.buf, deps.deps.len );
+    }
+    
+    if( STATUS_OK != nerr ){
+        free( *inject );
+        *inject = NULL;
+    }
+    // text with <?cs would not be literal when injected; keep the source
+    else if( page.buf && strstr( page.buf, "<?cs" ) ){
+        __sync_add_and_fetch( &cs->outUncacheable, 1 );
+    }
+    else if( !( out = DupBytes( ( page.buf ) ? page.buf : "", page.len ) ) ){
+        nerr = nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+    }
+    else
     {
-        // invalid arguments
-        if( !argv[1]->IsString() && !argv[1]->IsFunction() ){
-            retval = ThrowException( Exception::TypeError( String::New( "parseString( template:String, [parser_id:String], [callback:Function] )" ) ) );
-        }
-        // is parser_id
-        else if( argv[1]->IsString() )
+        free( *inject );
+        *inject = out;
+        // record the dependencies unless the declaration was replaced
+        if( page.buf && !deps.failed && 0 == pthread_mutex_lock( &cs->mutex ) )
         {
-            // find parser
-            if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)*String::Utf8Value( argv[1] ) ) ) ){
-                retval = ThrowException( Exception::ReferenceError( String::New( "faild to parseString: parser not found" ) ) );
+            if( ( frag = (Fragment_t*)ne_hash_lookup( cs->fragments, (void*)id ) ) &&
+                frag->serial == key->version &&
+                ( !deps.deps.len || ( copy = DupBytes( deps.deps.buf, deps.deps.len ) ) ) ){
+                free( frag->deps );
+                frag->deps = copy;
+                frag->depsLen = deps.deps.len;
+                keep = true;
             }
+            pthread_mutex_unlock( &cs->mutex );
         }
-        // is callback
-        else {
-            callback = 1;
+        key->canonLen = base;
+        key->hash = FNV1a64( FNV64_OFFSET, key->canon, base );
+        if( keep && ExtendKey( key, deps.deps.buf, deps.deps.len ) ){
+            cs->_outStore( key, &page, ttl );
         }
     }
+    string_clear( &deps.deps );
+    string_clear( &page );
+    
+    return nerr_pass( nerr );
+}
 
-    if( retval->IsUndefined() )
+// call from main or other thread
+NEOERR *ClearSilver::hookFileload( void *context, HDF *hdf, const char *filepath, char **inject )
+{
+    NEOERR *nerr = STATUS_OK;
+    //HandleScope scope;
+    ParseCtx_t *ctx = (ParseCtx_t*)context;
+    ClearSilver *cs = ctx->cs;
+    // hdf is the request overlay on overlay renders; loadpaths and their
+    // containment check come from the parser only
+    HDF *paths = hdf_get_child( ( ParserHDF ) ? ParserHDF : ctx->hdf, "Config.loadpaths" );
+    char *resolve = NULL;
+    char *key = NULL;
+    
+    *inject = NULL;
+    // relative path without loadpaths depends on cwd; do not cache it
+    if( ( paths || '/' == *filepath ) &&
+        STATUS_OK != ( nerr = LoadpathsKey( paths, filepath, &key ) ) ){
+        return nerr_pass( nerr );
+    }
+    
+    if( key && cs->_pathLookup( key, &resolve ) ){
+        // resolved by cache
+    }
+    else if( STATUS_OK == ( nerr = ResolvePath( paths, filepath, &resolve ) ) && key ){
+        cs->_pathStore( key, resolve );
+    }
+    free( key );
+    
+    if( resolve )
     {
-        // create parser
-        if( !ctx )
+        FileCache_t *cache = NULL;
+        Fragment_t *frag = NULL;
+        // fragment key and ttl of a missed cacheable include
+        OutCache_t key;
+        size_t base = 0;
+        uint64_t ttl = 0;
+        bool isHDF = false;
+        bool lookup = false;
+        bool miss = false;
+        // dependencies of a cached fragment, for the fragment including it
+        char *deps = NULL;
+        size_t depsLen = 0;
+        int rc = 0;
+        
+        memset( &key, 0, sizeof( OutCache_t ) );
+        // cache lock; only held to take a reference to the entry and to
+        // build the fragment key. the file is read, merged and copied
+        // without it.
+        if( ( rc = pthread_mutex_lock( &cs->mutex ) ) ){
+            nerr = nerr_raise( NERR_LOCK, "Mutex lock failed: %s", strerror(rc) );
+        }
+        else
         {
-            // create parser
-            Handle<Value> parser_id = cs->_createParser( NULL, true );
-            // exception
-            if( !parser_id->IsString() ){
-                retval = parser_id;
+            // load file if no cached
+            if( ( cache = cs->_cacheLookup( resolve ) ) ){
+                __sync_add_and_fetch( &cache->refs, 1 );
+                __sync_add_and_fetch( &ctx->stats.includeHits, 1 );
             }
-            // unknown error
-            else if( !( ctx = (ParseCtx_t*)ne_hash_lookup( cs->parseCache, (void*)*String::Utf8Value( parser_id ) ) ) ){
-                retval = ThrowException( Exception::ReferenceError( String::New( "faild to parseString: parser not found" ) ) );
+            else {
+                __sync_add_and_fetch( &ctx->stats.includeMisses, 1 );
+                nerr = cs->_cacheLoad( resolve, &cache );
             }
-        }
-        
-        if( ctx )
-        {
-            // already compiled
             
-            if( ctx->tmpl )
-            {
-                // fprintf( stdout, "no parse: %s\n", ctx->id );
-                // parse async
-                if( callback )
-                {
-                    Handle<Primitive> t = Undefined();
-                    Local<Function> cb = Local<Function>::Cast( argv[callback] );
-                    Local<Value> args[] = {
-                        reinterpret_cast<Local<Value>&>(t),
-                        String::New( ctx->id )
-                    };
-                    cb->Call( cb, 2, args );
-                }
-                // parse sync
-                else {
-                    retval = String::New( ctx->id );
-                }
-            }
-            else
+            if( STATUS_OK == nerr )
             {
-                // copy template string
-                if( !ctx->tmpl && -1 == ( ctx->len = asprintf( (char**)&ctx->tmpl, "%s", *String::Utf8Value( argv[0] ) ) ) ){
-                    retval = ThrowException( Exception::Error( String::New( strerror(errno) ) ) );
-                    ctx->tmpl = NULL;
-                    ctx->len = 0;
-                    // !!!: add call destroyParser
-                    // code...
-                }
-                // parse async
-                else if( callback )
-                {
-                    Baton_t *baton = new Baton_t();
-                    baton->ctx = (void*)ctx;
-                    // detouch from GC
-                    baton->callback = Persistent<Function>::New( Local<Function>::Cast( argv[callback] ) );
-                    cs->Ref();
-                    eio_custom( parseStringBeginEIO, EIO_PRI_DEFAULT, parseStringEndEIO, baton );
-                    ev_ref(EV_DEFAULT_UC);
+                char *ext = rindex( cache->id, '.' );
+                
+                isHDF = ( ext && !strcmp( ext, ".hdf" ) );
+                // included by a fragment render
+                if( FragmentDeps ){
+                    AddDep( FragmentDeps, cache->id, cache->mtime, cache->size );
                 }
-                // parse sync
-                else
+                // cacheable linclude while rendering; the key ends with the
+                // files the last render included
+                if( !isHDF && CurrentRender &&
+                    ( frag = (Fragment_t*)ne_hash_lookup( cs->fragments, (void*)cache->id ) ) &&
+                    FragmentKey( &key, frag, cache, hdf, CurrentRender->fallback ) )
                 {
-                    char *estr = NULL;
-                    
-                    // failed
-                    if( ( estr = CHECK_NEOERR( cs_parse_string( ctx->csp, (char*)ctx->tmpl, ctx->len ) ) ) )
-                    {
-                        retval = ThrowException( Exception::Error( String::New( estr ) ) );
-                        free(estr);
-                        if( ctx->delWhenFailed ){
-                            free((void*)ctx->tmpl);
-                            ctx->tmpl = NULL;
-                            ctx->len = 0;
-                            // !!!: add call destroyParser if dynamic create parser
-                        }
-                    }
-                    else {
-                        ctx->delWhenFailed = false;
-                        retval = String::New( ctx->id );
+                    base = key.canonLen;
+                    ttl = frag->ttl;
+                    lookup = cs->_depsFresh( frag->deps, frag->depsLen ) &&
+                             ExtendKey( &key, frag->deps, frag->depsLen );
+                    if( lookup && FragmentDeps && frag->depsLen ){
+                        depsLen = frag->depsLen;
+                        lookup = ( NULL != ( deps = DupBytes( frag->deps, depsLen ) ) );
                     }
                 }
-            //}
+            }
+            pthread_mutex_unlock( &cs->mutex );
+        }
+        
+        if( STATUS_OK != nerr ){
+            // not loaded
+        }
+        // is HDF
+        else if( isHDF )
+        {
+            nerr = ( cache->tree ) ? MergeHDF( hdf, cache->tree ) : hdf_read_string( hdf, cache->data );
+            if( STATUS_OK == nerr && !( *inject = strdup( "" ) ) ){
+                nerr = nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+            }
+        }
+        // cached output; without <?cs it parses as plain text
+        else if( lookup && ( *inject = cs->_outLookup( &key ) ) ){
+            if( FragmentDeps ){
+                MergeDeps( FragmentDeps, deps, depsLen );
+            }
+        }
+        else if( !( *inject = (char*)malloc( cache->len + 1 ) ) ){
+            // critical
+            nerr = nerr_raise( NERR_NOMEM, "%s", strerror(errno) );
+        }
+        // cs_parse_string tokenizes in place and frees the buffer,
+        // so text includes always need their own copy
+        else {
+            memcpy( *inject, cache->data, cache->len );
+            (*inject)[cache->len] = 0;
+            // missed; rendered below
+            miss = ( NULL != key.canon );
+        }
+        
+        // remove cache
+        if( cache && STATUS_OK != nerr && 0 == pthread_mutex_lock( &cs->mutex ) )
+        {
+            if( cache == ne_hash_lookup( cs->fileCache, cache->id ) ){
+                cs->_cacheRemove( cache );
+            }
+            pthread_mutex_unlock( &cs->mutex );
+        }
+        ReleaseFile( cache );
+        free( deps );
+        if( miss && STATUS_OK == nerr ){
+            nerr = _renderFragment( ctx, hdf, CurrentRender->fallback, resolve, &key, base, ttl, inject );
         }
+        free( key.canon );
+        free( resolve );
     }
     
-    return scope.Close( retval );
+    if( STATUS_OK == nerr && !*inject && -1 == asprintf( inject, "[include] failed to include %s\n", strerror(ENOENT) ) ){
+        // critical
+        nerr = nerr_raise( NERR_SYSTEM, "%s", strerror(errno) );
+    }
+
+    return nerr_pass(nerr);
 }
-*/
 
 void ClearSilver::Initialize( Handle<Object> target )
 {
@@ -1342,11 +6241,29 @@ void ClearSilver::Initialize( Handle<Object> target )
     NODE_SET_PROTOTYPE_METHOD( t, "createParser", createParser );
     NODE_SET_PROTOTYPE_METHOD( t, "parseString", parseString );
     NODE_SET_PROTOTYPE_METHOD( t, "removeParser", removeParser );
+    NODE_SET_PROTOTYPE_METHOD( t, "replaceTemplate", replaceTemplate );
     NODE_SET_PROTOTYPE_METHOD( t, "render", render );
+    NODE_SET_PROTOTYPE_METHOD( t, "renderBuffer", renderBuffer );
+    NODE_SET_PROTOTYPE_METHOD( t, "renderStream", renderStream );
+    NODE_SET_PROTOTYPE_METHOD( t, "renderMany", renderMany );
     NODE_SET_PROTOTYPE_METHOD( t, "setValue", setValue );
     NODE_SET_PROTOTYPE_METHOD( t, "getValue", getValue );
     NODE_SET_PROTOTYPE_METHOD( t, "removeValue", removeValue );
     NODE_SET_PROTOTYPE_METHOD( t, "dump", dump );
+    NODE_SET_PROTOTYPE_METHOD( t, "resolveNode", resolveNode );
+    NODE_SET_PROTOTYPE_METHOD( t, "setNodeValue", setNodeValue );
+    NODE_SET_PROTOTYPE_METHOD( t, "getNodeValue", getNodeValue );
+    NODE_SET_PROTOTYPE_METHOD( t, "setGlobal", setGlobal );
+    NODE_SET_PROTOTYPE_METHOD( t, "stats", stats );
+    NODE_SET_PROTOTYPE_METHOD( t, "resetStats", resetStats );
+    NODE_SET_PROTOTYPE_METHOD( t, "setCacheOptions", setCacheOptions );
+    NODE_SET_PROTOTYPE_METHOD( t, "setRenderPool", setRenderPool );
+    NODE_SET_PROTOTYPE_METHOD( t, "renderPoolStats", renderPoolStats );
+    NODE_SET_PROTOTYPE_METHOD( t, "cacheStats", cacheStats );
+    NODE_SET_PROTOTYPE_METHOD( t, "cacheFragment", cacheFragment );
+    NODE_SET_PROTOTYPE_METHOD( t, "saveSnapshot", saveSnapshot );
+    NODE_SET_PROTOTYPE_METHOD( t, "loadSnapshot", loadSnapshot );
+    NODE_SET_PROTOTYPE_METHOD( t, "preload", preload );
     target->Set( String::NewSymbol("ClearSilver"), t->GetFunction() );
 }
 
@@ -1354,6 +6271,8 @@ extern "C" {
     static void init( Handle<Object> target ){
         HandleScope scope;
         ClearSilver::Initialize( target );
+        RenderStream::Initialize( target );
+        HDFNode::Initialize( target );
     }
     NODE_MODULE( ClearSilver, init );
 };